@@ -0,0 +1,137 @@
+// File: pipe_bench.cpp
+// Throughput of the ring-buffer Pipe against the previous std::queue<char>
+// implementation, for one producer and one consumer thread.
+#include "pipe.hpp"
+#include "logger.hpp"
+
+#include <queue>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+namespace
+{
+    // The byte-at-a-time Pipe this repository shipped before the ring buffer,
+    // kept verbatim (logging included) as the baseline.
+    class LegacyPipe
+    {
+    public:
+        explicit LegacyPipe(size_t capacity) : capacity_(capacity) {}
+
+        bool write(const char *data, size_t len, std::atomic<bool> &stop)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            size_t written = 0;
+
+            while (written < len && !stop.load())
+            {
+                while (queue_.size() >= capacity_ && !stop.load())
+                    condNotFull_.wait(lock);
+
+                if (stop.load())
+                    return false;
+
+                size_t batchSize = std::min(capacity_ - queue_.size(), len - written);
+                for (size_t i = 0; i < batchSize; ++i)
+                    queue_.push(data[written + i]);
+
+                written += batchSize;
+                condNotEmpty_.notify_one();
+            }
+
+            return true;
+        }
+
+        size_t read(char *dest, size_t len, std::atomic<bool> &stop)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            size_t bytesRead = 0;
+
+            while (bytesRead < len)
+            {
+                if (stop.load() && queue_.empty())
+                {
+                    Logger::Log(LogLevel::TRACE, "Pipe::read: Returning EOF. Pipe is empty and stop is requested.");
+                    break;
+                }
+
+                if (!queue_.empty())
+                {
+                    dest[bytesRead++] = queue_.front();
+                    queue_.pop();
+                    condNotFull_.notify_one();
+                }
+                else
+                {
+                    Logger::Log(LogLevel::TRACE, "Pipe::read: Waiting for data in the queue.");
+                    condNotEmpty_.wait(lock, [&]
+                                       { return !queue_.empty() || stop.load(); });
+                }
+            }
+
+            Logger::Log(LogLevel::TRACE, "Pipe::read: Read " + std::to_string(bytesRead) + " bytes. Requested: " + std::to_string(len));
+            return bytesRead;
+        }
+
+    private:
+        std::queue<char> queue_;
+        size_t capacity_;
+        std::mutex mutex_;
+        std::condition_variable condNotEmpty_;
+        std::condition_variable condNotFull_;
+    };
+
+    template <typename PipeT>
+    double run(size_t totalBytes, size_t writeChunk, size_t readChunk)
+    {
+        PipeT pipe(4 * 1024 * 1024);
+        std::atomic<bool> stop{false};
+        std::vector<char> source(writeChunk, 'x');
+
+        auto start = std::chrono::steady_clock::now();
+
+        std::thread producer([&]
+                             {
+            size_t sent = 0;
+            while (sent < totalBytes)
+            {
+                size_t n = std::min(writeChunk, totalBytes - sent);
+                pipe.write(source.data(), n, stop);
+                sent += n;
+            } });
+
+        std::vector<char> sink(readChunk);
+        size_t received = 0;
+        while (received < totalBytes)
+            received += pipe.read(sink.data(), std::min(readChunk, totalBytes - received), stop);
+
+        producer.join();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return static_cast<double>(totalBytes) / elapsed.count() / 1e9;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t megabytes = argc > 1 ? std::stoul(argv[1]) : 1024;
+    const size_t writeChunk = 16 * 1024; // typical curl write callback size
+    const size_t readChunk = 128 * 1024; // typical FUSE read size
+
+    Logger::SetLogLevel(LogLevel::INFO);
+
+    size_t total = megabytes * 1024 * 1024;
+    double ring = run<Pipe>(total, writeChunk, readChunk);
+
+    // The legacy pipe is orders of magnitude slower; keep its run short.
+    size_t legacyTotal = std::max<size_t>(total / 16, 1024 * 1024);
+    double legacy = run<LegacyPipe>(legacyTotal, writeChunk, readChunk);
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "ring pipe:   " << ring << " GB/s\n"
+              << "legacy pipe: " << legacy << " GB/s\n"
+              << "speedup:     " << ring / legacy << "x\n";
+    return 0;
+}
@@ -0,0 +1,206 @@
+// File: ring_reply_bench.cpp
+// Copies per byte, and throughput, of replying to .ts reads out of the
+// StreamRing. A tmpfs file stands in for /dev/fuse: writing into it costs
+// the one kernel copy into page cache that a FUSE reply costs.
+//   copy     copy out of the ring into a reply buffer, then writev (the old
+//            fs_read)
+//   inplace  peek, writev straight from the ring's mapping
+//   splice   peek, splice the span from the ring's memfd through a pipe
+//            (FUSE_CAP_SPLICE_WRITE with fd-backed reply buffers)
+// Feeding the ring is the same for every mode and is not timed.
+#include "stream_ring.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    constexpr size_t RingBytes = 8 * 1024 * 1024;
+    constexpr size_t TotalBytes = 1024ull * 1024 * 1024;
+    // Upstream chunks are whole TS packets, so replies regularly wrap
+    constexpr size_t ChunkBytes = 188 * 5000;
+    // struct fuse_out_header
+    constexpr size_t HeaderBytes = 16;
+
+    enum class Mode
+    {
+        Copy,
+        InPlace,
+        Splice
+    };
+
+    struct Sink
+    {
+        int file = -1;
+        int pipe[2] = {-1, -1};
+        size_t round = 0; // Bytes moved through the pipe at a time
+    };
+
+    void die(const char *what)
+    {
+        perror(what);
+        exit(1);
+    }
+
+    void spliceAll(int from, loff_t *fromPos, int to, loff_t *toPos, size_t len)
+    {
+        while (len > 0)
+        {
+            ssize_t n = splice(from, fromPos, to, toPos, len, 0);
+            if (n <= 0)
+                die("splice");
+            len -= static_cast<size_t>(n);
+        }
+    }
+
+    // Sends one reply of span (or of buffer, for Mode::Copy) into the sink
+    void reply(Mode mode, const Sink &sink, const StreamRing::Span &span, const char *buffer, size_t size)
+    {
+        static char header[HeaderBytes] = {};
+        if (mode == Mode::Splice)
+        {
+            loff_t out = 0;
+            iovec iov = {header, HeaderBytes};
+            if (vmsplice(sink.pipe[1], &iov, 1, 0) != static_cast<ssize_t>(HeaderBytes))
+                die("vmsplice");
+            spliceAll(sink.pipe[0], nullptr, sink.file, &out, HeaderBytes);
+
+            // Through the pipe in rounds it can always hold, in case it
+            // could not be grown to a whole reply
+            for (size_t i = 0; i < span.pieces; ++i)
+            {
+                loff_t in = static_cast<loff_t>(span.offset[i]);
+                for (size_t left = span.length[i]; left > 0;)
+                {
+                    size_t n = std::min(left, sink.round);
+                    spliceAll(span.fd, &in, sink.pipe[1], nullptr, n);
+                    spliceAll(sink.pipe[0], nullptr, sink.file, &out, n);
+                    left -= n;
+                }
+            }
+            return;
+        }
+
+        iovec iov[3] = {{header, HeaderBytes}};
+        int count = 1;
+        if (mode == Mode::Copy)
+        {
+            iov[count++] = {const_cast<char *>(buffer), size};
+        }
+        else
+        {
+            for (size_t i = 0; i < span.pieces; ++i)
+                iov[count++] = {const_cast<char *>(span.data[i]), span.length[i]};
+        }
+        if (pwritev(sink.file, iov, count, 0) != static_cast<ssize_t>(HeaderBytes + size))
+            die("pwritev");
+    }
+
+    double run(Mode mode, size_t requestSize)
+    {
+        StreamRing ring(RingBytes, SlowReaderPolicy::Skip);
+        auto reader = ring.openReader();
+
+        Sink sink;
+        sink.file = memfd_create("ring_reply_sink", 0);
+        if (sink.file < 0 || pipe(sink.pipe) != 0)
+            die("sink");
+        fcntl(sink.pipe[1], F_SETPIPE_SZ, static_cast<int>(requestSize + 4096));
+        // Half the pipe, leaving slots for pieces that are not page aligned
+        sink.round = static_cast<size_t>(fcntl(sink.pipe[1], F_GETPIPE_SZ)) / 2;
+
+        std::vector<char> chunk(ChunkBytes);
+        for (size_t i = 0; i < chunk.size(); ++i)
+            chunk[i] = static_cast<char>(i * 31);
+        std::vector<char> buffer(requestSize);
+
+        std::chrono::steady_clock::duration elapsed{};
+        size_t replied = 0;
+        while (replied < TotalBytes)
+        {
+            ring.tryWrite(chunk.data(), chunk.size());
+
+            auto start = std::chrono::steady_clock::now();
+            while (true)
+            {
+                StreamRing::Span span;
+                if (ring.peek(*reader, requestSize, 1, span) != StreamRing::ReadStatus::Data)
+                    break;
+                if (mode == Mode::Splice && span.fd < 0)
+                {
+                    std::cerr << "No memfd behind the ring; splice mode unavailable\n";
+                    exit(1);
+                }
+
+                if (mode == Mode::Copy)
+                {
+                    // What the old fs_read did: copy out, release, reply
+                    for (size_t i = 0, at = 0; i < span.pieces; at += span.length[i++])
+                        std::memcpy(buffer.data() + at, span.data[i], span.length[i]);
+                    ring.consume(*reader, span);
+                }
+
+                reply(mode, sink, span, buffer.data(), span.size);
+                if (mode != Mode::Copy)
+                    ring.consume(*reader, span);
+                replied += span.size;
+            }
+            elapsed += std::chrono::steady_clock::now() - start;
+        }
+
+        ring.closeReader(reader);
+        close(sink.file);
+        close(sink.pipe[0]);
+        close(sink.pipe[1]);
+        return static_cast<double>(replied) / (1024.0 * 1024 * 1024) / std::chrono::duration<double>(elapsed).count();
+    }
+}
+
+int main()
+{
+    struct Row
+    {
+        const char *name;
+        Mode mode;
+        int userCopies;
+        int kernelCopies;
+    };
+    const Row rows[] = {
+        {"copy", Mode::Copy, 1, 1},
+        {"inplace", Mode::InPlace, 0, 1},
+        {"splice", Mode::Splice, 0, 1},
+    };
+
+    std::cout << "Replying " << TotalBytes / (1024 * 1024) << " MiB per mode from a "
+              << RingBytes / (1024 * 1024) << " MiB ring\n"
+              << std::left << std::setw(10) << "mode" << std::right
+              << std::setw(12) << "request"
+              << std::setw(12) << "user cp/B"
+              << std::setw(14) << "kernel cp/B"
+              << std::setw(12) << "GiB/s" << "\n";
+
+    for (size_t requestSize : {128 * 1024, 1024 * 1024})
+    {
+        for (const auto &row : rows)
+        {
+            double rate = run(row.mode, requestSize);
+            std::cout << std::left << std::setw(10) << row.name << std::right
+                      << std::setw(10) << requestSize / 1024 << "Ki"
+                      << std::setw(12) << row.userCopies
+                      << std::setw(14) << row.kernelCopies
+                      << std::setw(12) << std::fixed << std::setprecision(2) << rate << "\n";
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,155 @@
+// File: ts_scan_bench.cpp
+// Single-core throughput of the TS scan kernels, for each one this CPU can run:
+//   decode    header sync check and PID/CC/flag extraction over aligned packets
+//   findSync  searching bytes that hold no packet alignment (the resync path)
+// and of TsTracker::feed as the ingest path runs it, with the best kernel.
+// Each kernel must first produce what the scalar one does on the stream.
+#include "logger.hpp"
+#include "ts_scan.hpp"
+#include "ts_tracker.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace
+{
+    constexpr size_t PacketSize = TsTracker::PacketSize;
+    constexpr size_t Packets = 64 * 1024 * 1024 / PacketSize;
+    constexpr size_t Batch = 64;
+    // Upstream chunks, as writeCallback hands them to the ring
+    constexpr size_t ChunkBytes = 16 * 1024;
+
+    // Packets on a handful of PIDs with running counters; payload is noise
+    std::vector<uint8_t> makeStream()
+    {
+        std::vector<uint8_t> data(Packets * PacketSize);
+        std::mt19937 rng(1);
+        uint8_t cc[8] = {};
+        for (size_t p = 0; p < Packets; ++p)
+        {
+            uint8_t *packet = &data[p * PacketSize];
+            unsigned stream = rng() % 8;
+            uint16_t pid = static_cast<uint16_t>(0x100 + stream);
+            packet[0] = 0x47;
+            packet[1] = static_cast<uint8_t>((pid >> 8) | (rng() % 16 == 0 ? 0x40 : 0));
+            packet[2] = static_cast<uint8_t>(pid);
+            packet[3] = static_cast<uint8_t>(0x10 | (cc[stream]++ & 0xF));
+            for (size_t i = 4; i < PacketSize; ++i)
+                packet[i] = static_cast<uint8_t>(rng());
+        }
+        return data;
+    }
+
+    // Noise with no sync byte at all, so findSync has to cover every byte
+    std::vector<uint8_t> makeNoise()
+    {
+        std::vector<uint8_t> data(Packets * PacketSize);
+        std::mt19937 rng(2);
+        for (auto &byte : data)
+        {
+            byte = static_cast<uint8_t>(rng());
+            if (byte == 0x47)
+                byte = 0x46;
+        }
+        return data;
+    }
+
+    // Every packet of stream, decoded by kernel in the batches timed below
+    std::vector<TsHeader> decodeAll(const TsScanKernel &kernel, const std::vector<uint8_t> &stream)
+    {
+        std::vector<TsHeader> headers(Packets);
+        for (size_t p = 0; p < Packets; p += Batch)
+        {
+            size_t count = std::min(Batch, Packets - p);
+            if (kernel.decode(&stream[p * PacketSize], count, &headers[p]) != count)
+                std::abort();
+        }
+        return headers;
+    }
+
+    template <typename Fn>
+    double rate(size_t bytes, Fn &&fn)
+    {
+        // Best of a few passes, so one disturbed pass does not count
+        double best = 0;
+        for (int pass = 0; pass < 5; ++pass)
+        {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            best = std::max(best, static_cast<double>(bytes) / 1e9 / seconds);
+        }
+        return best;
+    }
+
+    void print(const std::string &kernel, const char *what, double gbps)
+    {
+        std::cout << std::left << std::setw(10) << kernel << std::setw(10) << what
+                  << std::right << std::setw(10) << std::fixed << std::setprecision(2) << gbps << "\n";
+    }
+}
+
+int main()
+{
+    Logger::SetLogLevel(LogLevel::WARN);
+
+    const std::vector<uint8_t> stream = makeStream();
+    const std::vector<uint8_t> noise = makeNoise();
+    std::vector<TsHeader> headers(Batch);
+
+    // Kernels must agree with the scalar one before their speed means anything
+    const TsScanKernel *scalar = supportedTsScanKernels()[0];
+    const std::vector<TsHeader> expected = decodeAll(*scalar, stream);
+    const size_t expectedSync = scalar->findSync(stream.data() + 1, stream.size() - 1);
+
+    std::cout << "Scanning " << stream.size() / (1024 * 1024) << " MiB on one core\n"
+              << std::left << std::setw(10) << "kernel" << std::setw(10) << "op"
+              << std::right << std::setw(10) << "GB/s" << "\n";
+
+    for (const TsScanKernel *kernel : supportedTsScanKernels())
+    {
+        if (std::memcmp(decodeAll(*kernel, stream).data(), expected.data(), Packets * sizeof(TsHeader)) != 0 ||
+            kernel->findSync(stream.data() + 1, stream.size() - 1) != expectedSync)
+        {
+            std::cerr << kernel->name << " disagrees with " << scalar->name << "\n";
+            std::abort();
+        }
+
+        uint64_t sink = 0;
+        double decode = rate(stream.size(), [&]
+                             {
+            for (size_t p = 0; p < Packets; p += Batch)
+            {
+                size_t count = std::min(Batch, Packets - p);
+                if (kernel->decode(&stream[p * PacketSize], count, headers.data()) != count)
+                    std::abort();
+                sink += headers[0].bits;
+            } });
+        print(kernel->name, "decode", decode);
+
+        double findSync = rate(noise.size(), [&]
+                               {
+            if (kernel->findSync(noise.data(), noise.size()) != noise.size())
+                std::abort();
+            sink += 1; });
+        print(kernel->name, "findSync", findSync);
+
+        if (sink == 0)
+            std::abort();
+    }
+
+    double feed = rate(stream.size(), [&]
+                       {
+        TsTracker tracker;
+        for (size_t i = 0; i < stream.size(); i += ChunkBytes)
+            tracker.feed(reinterpret_cast<const char *>(&stream[i]), std::min(ChunkBytes, stream.size() - i));
+        if (!tracker.startPoint().synced)
+            std::abort(); });
+    print(bestTsScanKernel().name, "feed", feed);
+    return 0;
+}
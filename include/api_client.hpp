@@ -3,11 +3,21 @@
 
 #include <string>
 #include <map>
+#include <memory>
+#include <vector>
+#include <functional>
 #include "sgfs.hpp"
 
+struct VirtualFile;
+class Catalog;
+
 class APIClient
 {
 public:
+    // Called after a reload with every path that was added, removed or
+    // now points at a different URL. Runs without catalogWriteMutex held.
+    using ChangeCallback = std::function<void(const std::vector<std::string> &paths)>;
+
     APIClient(const std::string &host,
               const std::string &port,
               const std::string &apiKey,
@@ -18,8 +28,24 @@ public:
 
     const std::map<int, SGFS> &getGroups() const;
 
+    void setChangeCallback(ChangeCallback onChange);
+
+    // Reports paths changed outside a reload (e.g. a delete command) to the
+    // change callback. Call without catalogWriteMutex held.
+    void notifyChanged(const std::vector<std::string> &paths) const;
+
+    // Where the last good catalog is kept between runs.
+    void setSnapshotPath(const std::string &path);
+
+    // Fills the tree from the snapshot, if there is one. Call before mounting.
+    bool loadSnapshot();
+
 private:
     std::string baseUrl;
     std::map<int, SGFS> groups;
-    void processResponse(const std::string &response);
+    ChangeCallback onChange_;
+    std::string snapshotPath_;
+    void streamCatalog(std::map<int, SGFS> &nextGroups, std::map<std::string, std::shared_ptr<VirtualFile>> &next);
+    void prefetchContent() const;
+    void applyCatalog(Catalog &catalog, std::map<std::string, std::shared_ptr<VirtualFile>> &next, std::vector<std::string> &changed);
 };
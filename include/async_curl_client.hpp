@@ -7,22 +7,60 @@
 #include <mutex>
 #include <atomic>
 #include <map>
+#include <memory>
+#include <vector>
 
+// Process-wide HTTP client. One worker thread sleeps in curl_multi_poll until
+// a socket is ready or another thread calls curl_multi_wakeup, and hands each
+// chunk to the caller as soon as curl receives it.
 class AsyncCurlClient : public IStreamingClient
 {
 public:
     AsyncCurlClient();
     ~AsyncCurlClient();
 
-    void fetchStreamAsync(const std::string &url, std::function<void(const std::string &data)> onDataReceived) override;
+    AsyncCurlClient(const AsyncCurlClient &) = delete;
+    AsyncCurlClient &operator=(const AsyncCurlClient &) = delete;
+
+    void fetchStreamAsync(const std::string &url, ChunkCallback onChunk, CompleteCallback onComplete = nullptr,
+                          const std::vector<std::string> &headers = {}) override;
+    void headAsync(const std::string &url, CompleteCallback onComplete) override;
 
 private:
+    // Every transfer has to end, even on a stalled connection: callers such
+    // as ContentCache keep readers waiting until it completes
+    static constexpr long ConnectTimeoutSeconds = 10;
+    static constexpr long LowSpeedLimitBytes = 1; // per second, for ...
+    static constexpr long LowSpeedTimeSeconds = 30; // ... this long
+
+    struct Transfer
+    {
+        CURL *easy = nullptr;
+        std::string url;
+        ChunkCallback onChunk;
+        CompleteCallback onComplete;
+        curl_slist *headers = nullptr;
+        std::string etag;
+        std::string lastModified;
+    };
+
     CURLM *multiHandle_;
     std::thread workerThread_;
     std::atomic<bool> isRunning_{true};
-    std::map<CURL *, std::function<void()>> callbacks_;
+
+    // Worker thread only
+    std::map<CURL *, std::unique_ptr<Transfer>> transfers_;
+
+    // Handed from callers to the worker
+    std::vector<std::unique_ptr<Transfer>> pending_;
     std::mutex mutex_;
 
     static size_t writeCallback(void *contents, size_t size, size_t nmemb, void *userp);
+    static size_t headerCallback(char *buffer, size_t size, size_t nitems, void *userp);
+    static std::unique_ptr<Transfer> createTransfer(const std::string &url, CompleteCallback onComplete);
+    static void cleanup(Transfer &transfer);
+    void queue(std::unique_ptr<Transfer> transfer);
+    void addPending();
+    void completeTransfers();
     void eventLoop();
 };
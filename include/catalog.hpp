@@ -0,0 +1,179 @@
+// File: catalog.hpp
+#pragma once
+#define FUSE_USE_VERSION 35
+#include <fuse3/fuse_lowlevel.h>
+#include <array>
+#include <bitset>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct VirtualFile;
+
+// The mounted tree, indexed four ways:
+//
+//  - by path, for finds, diffing reloads and scans
+//  - by (parent inode, name), so lookup is one hash probe
+//  - as a directory tree, so readdir walks only the children of one
+//    directory
+//  - by content URL, for the .xml/.m3u files ContentCache serves
+//
+// A published Catalog is never modified: writers copy the current one,
+// edit the copy and swap it in (SMFS::updateCatalog), so readers need no
+// lock. Only the copy being built is edited, by one writer at a time.
+//
+// Each index is split into a fixed number of shards that versions share.
+// A copy takes references to all of them, and clones a shard only when
+// it first edits it, so a write costs the shards it touches rather than
+// the whole lineup.
+class Catalog
+{
+public:
+    struct Node
+    {
+        fuse_ino_t ino;
+        std::shared_ptr<VirtualFile> file; // nullptr for directories
+    };
+
+    // Children of one directory, in name order
+    using Children = std::map<std::string, Node, std::less<>>;
+
+    Catalog() = default;
+    Catalog(const Catalog &other) = default;
+    Catalog &operator=(const Catalog &) = delete;
+
+    // Returns nullptr (found = false) if path is not in the catalog.
+    std::shared_ptr<VirtualFile> find(const std::string &path, bool &found) const;
+
+    // Calls fn(path, file) for every entry, in no particular order.
+    template <typename Fn>
+    void forEachFile(Fn &&fn) const
+    {
+        files_.forEach([&](const FileShard &shard)
+                       {
+                           for (const auto &[path, file] : shard)
+                           {
+                               fn(path, file);
+                           } });
+    }
+
+    // Adds path, or points it at file if it already exists.
+    void set(const std::string &path, std::shared_ptr<VirtualFile> file);
+
+    // Removes path. Children of a removed directory stay until removed.
+    void erase(const std::string &path);
+
+    // The entry called name in directory parent, or nullptr.
+    const Node *lookup(fuse_ino_t parent, std::string_view name) const;
+
+    // The children of dir, or nullptr if it has none.
+    const Children *children(fuse_ino_t dir) const;
+
+    // Paths of the .xml/.m3u files served from url, or nullptr if none.
+    const std::vector<std::string> *contentPaths(const std::string &url) const;
+
+private:
+    // Maps split by key hash. Copies share every shard until they edit it.
+    template <typename Map>
+    class Shards
+    {
+    public:
+        Shards()
+        {
+            for (auto &shard : shards_)
+            {
+                shard = std::make_shared<Map>();
+            }
+            owned_.set();
+        }
+
+        // The copy owns nothing yet
+        Shards(const Shards &other) : shards_(other.shards_) {}
+        Shards &operator=(const Shards &) = delete;
+
+        const Map &at(size_t hash) const { return *shards_[index(hash)]; }
+
+        // The shard for hash, cloned first if another version shares it
+        Map &edit(size_t hash)
+        {
+            size_t i = index(hash);
+            if (!owned_[i])
+            {
+                shards_[i] = std::make_shared<Map>(*shards_[i]);
+                owned_.set(i);
+            }
+            return *shards_[i];
+        }
+
+        template <typename Fn>
+        void forEach(Fn &&fn) const
+        {
+            for (const auto &shard : shards_)
+            {
+                fn(*shard);
+            }
+        }
+
+    private:
+        static constexpr size_t Count = 256;
+
+        // Top bits, so the maps inside see keys spread over all their buckets
+        static size_t index(size_t hash) { return (hash * 0x9e3779b97f4a7c15ull) >> 56; }
+
+        std::array<std::shared_ptr<Map>, Count> shards_;
+        std::bitset<Count> owned_;
+    };
+
+    struct Key
+    {
+        fuse_ino_t parent;
+        std::string name;
+    };
+
+    struct KeyView
+    {
+        fuse_ino_t parent;
+        std::string_view name;
+    };
+
+    struct KeyHash
+    {
+        using is_transparent = void;
+
+        size_t operator()(const KeyView &key) const
+        {
+            return std::hash<std::string_view>()(key.name) ^ (std::hash<fuse_ino_t>()(key.parent) * 0x9e3779b97f4a7c15ull);
+        }
+        size_t operator()(const Key &key) const { return (*this)(KeyView{key.parent, key.name}); }
+    };
+
+    struct KeyEqual
+    {
+        using is_transparent = void;
+
+        template <typename A, typename B>
+        bool operator()(const A &a, const B &b) const
+        {
+            return a.parent == b.parent && std::string_view(a.name) == std::string_view(b.name);
+        }
+    };
+
+    using FileShard = std::unordered_map<std::string, std::shared_ptr<VirtualFile>>;
+    using NodeShard = std::unordered_map<Key, Node, KeyHash, KeyEqual>;
+    using DirShard = std::unordered_map<fuse_ino_t, Children>;
+    using UrlShard = std::unordered_map<std::string, std::vector<std::string>>;
+
+    void indexContent(const std::string &path, const std::shared_ptr<VirtualFile> &file, bool add);
+    static void split(const std::string &path, std::string &parent, std::string &name);
+
+    static size_t hashPath(std::string_view path) { return std::hash<std::string_view>()(path); }
+    static size_t hashIno(fuse_ino_t ino) { return std::hash<fuse_ino_t>()(ino); }
+
+    Shards<FileShard> files_;
+    Shards<NodeShard> nodes_;
+    Shards<DirShard> dirs_;
+    Shards<UrlShard> contentPaths_;
+};
@@ -0,0 +1,77 @@
+// File: catalog_parser.hpp
+#pragma once
+#include "sgfs.hpp"
+#include <nlohmann/json.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+
+// SAX handler for the getsmfs catalog:
+//
+//   { "<groupId>": { "name": ..., "url": ..., "smfs": [ { "name": ..., "url": ... }, ... ] }, ... }
+//
+// Groups and their files are handed to the callbacks as soon as they are
+// complete, so no DOM or per-group file list of the whole lineup is built.
+// Unknown keys and nested values are skipped.
+class CatalogParser : public nlohmann::json_sax<nlohmann::json>
+{
+public:
+    // A group's callback always runs before the callbacks for its files.
+    using GroupCallback = std::function<void(int groupId, const SGFS &group)>;
+    using FileCallback = std::function<void(const SGFS &group, const SMFile &file)>;
+
+    CatalogParser(GroupCallback onGroup, FileCallback onFile);
+
+    // Description of the parse error, if sax_parse failed.
+    const std::string &error() const { return error_; }
+
+    bool null() override;
+    bool boolean(bool val) override;
+    bool number_integer(number_integer_t val) override;
+    bool number_unsigned(number_unsigned_t val) override;
+    bool number_float(number_float_t val, const string_t &s) override;
+    bool string(string_t &val) override;
+    bool binary(binary_t &val) override;
+    bool start_object(std::size_t elements) override;
+    bool key(string_t &val) override;
+    bool end_object() override;
+    bool start_array(std::size_t elements) override;
+    bool end_array() override;
+    bool parse_error(std::size_t position, const std::string &lastToken, const nlohmann::detail::exception &ex) override;
+
+private:
+    // Nesting depth: 1 = catalog, 2 = group, 3 = "smfs" array, 4 = file
+    static constexpr int GroupDepth = 2;
+    static constexpr int FilesDepth = 3;
+    static constexpr int FileDepth = 4;
+
+    enum class Field
+    {
+        None,
+        Name,
+        Url,
+        Files
+    };
+
+    void scalar();
+    void startGroup();
+    void finishGroup();
+    void emitFile();
+
+    GroupCallback onGroup_;
+    FileCallback onFile_;
+
+    int depth_ = 0;
+    Field field_ = Field::None;
+    bool inFiles_ = false;
+
+    std::string groupKey_;
+    int groupId_ = 0;
+    SGFS group_;
+    bool groupEmitted_ = false;
+    SMFile file_;
+    // Files that arrived before their group's name and URL
+    std::vector<SMFile> pending_;
+
+    std::string error_;
+};
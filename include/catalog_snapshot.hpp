@@ -0,0 +1,35 @@
+// File: catalog_snapshot.hpp
+#pragma once
+#include "sgfs.hpp"
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+struct VirtualFile;
+
+// Last good catalog on disk, so the tree can be served before the API
+// answers. The file is a fixed header, fixed-size entry and group records,
+// and one string blob referenced by offset, so it can be read straight
+// from a mapping:
+//
+//   Header | Entry[entryCount] | Group[groupCount] | strings
+//
+// Integers are in host byte order; a snapshot from another machine is
+// rejected by the magic/version check or the checksum.
+class CatalogSnapshot
+{
+public:
+    using Files = std::map<std::string, std::shared_ptr<VirtualFile>>;
+    using Groups = std::map<int, SGFS>;
+    using Inodes = std::unordered_map<std::string, uint64_t>;
+
+    // Writes files (nullptr = directory) and groups to path atomically,
+    // along with the inode each path currently has.
+    static bool save(const std::string &path, const Files &files, const Groups &groups);
+
+    // Fills files, groups and the inodes they had from path. Returns false,
+    // leaving all three untouched, if there is no usable snapshot.
+    static bool load(const std::string &path, Files &files, Groups &groups, Inodes &inodes);
+};
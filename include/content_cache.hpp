@@ -0,0 +1,131 @@
+// File: content_cache.hpp
+#pragma once
+#include "i_streaming_client.hpp"
+#include <sys/types.h>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <optional>
+
+// Shared cache of static virtual file content (.xml, .m3u), keyed by URL.
+//
+// Each URL is downloaded once into a Body that grows as data arrives, so a
+// read is answered as soon as its own byte range is in. Once a copy is older
+// than the TTL the next open revalidates it with If-None-Match /
+// If-Modified-Since in the background; the old copy keeps being served until
+// a changed document has fully arrived. Concurrent misses share one fetch.
+// Sizes come from the cached copy or, before one exists, a HEAD request
+// made in the background; the change callback reports when it is in.
+//
+// With a persist directory set, every downloaded version is also written to
+// disk as it arrives and served through mmap once complete, and an index of
+// validators is kept next to it. After a restart those copies are served
+// right away and revalidated in the background.
+class ContentCache
+{
+public:
+    // One downloaded version of a document. Open handles hold on to the
+    // version they started with, so a refresh never mixes two versions.
+    class Body
+    {
+    public:
+        Body() = default;
+        ~Body();
+
+        // Copies up to size bytes at offset into buf, waiting until that range
+        // has arrived or the download ended. Returns the number of bytes copied
+        // (0 at EOF) or -EIO if the download failed before reaching offset.
+        ssize_t read(char *buf, size_t size, off_t offset) const;
+
+    private:
+        friend class ContentCache;
+
+        static constexpr size_t BlockSize = 256 * 1024;
+
+        void append(std::string_view data);
+        void finish(bool ok);
+        std::optional<size_t> completeSize() const;
+
+        // A complete copy backed by a file mapping; nullptr if it cannot be
+        // mapped or is not size bytes long.
+        static std::shared_ptr<Body> mapFile(const std::string &path, size_t size);
+
+        mutable std::mutex mutex_;
+        mutable std::condition_variable cond_;
+        // Fixed-size blocks, so growing never moves bytes already stored
+        std::vector<std::unique_ptr<char[]>> blocks_;
+        size_t size_ = 0;
+        bool complete_ = false;
+        bool failed_ = false;
+        // Set for copies served from disk instead of blocks_
+        const char *mapped_ = nullptr;
+    };
+
+    // Called with the URL whenever a different version of a document has
+    // been cached, so the kernel's copy can be invalidated. Runs on the
+    // client's worker thread with no cache lock held.
+    using ChangeCallback = std::function<void(const std::string &url)>;
+
+    explicit ContentCache(IStreamingClient &client);
+
+    void setTtl(std::chrono::seconds ttl);
+    void setChangeCallback(ChangeCallback onChange);
+
+    // Keeps downloaded content under dir and loads what an earlier run left
+    // there. Call once at startup, before the first open.
+    void setPersistDir(const std::string &dir);
+
+    // Starts revalidating (or fetching) url in the background.
+    void prefetch(const std::string &url);
+
+    // Size of the document at url, from the cached copy if it is complete,
+    // otherwise from the last (shared, TTL-cached) HEAD request. Never
+    // blocks: while no size is known it starts a HEAD and returns nullopt,
+    // and the change callback runs once the HEAD reports one.
+    std::optional<size_t> size(const std::string &url);
+
+    // Current version of url, starting or revalidating the download as
+    // needed. Never blocks on the network. Returns nullptr if no fetch
+    // could be started.
+    std::shared_ptr<const Body> open(const std::string &url);
+
+private:
+    struct DiskStore;
+
+    struct Entry
+    {
+        std::mutex mutex;
+        std::shared_ptr<Body> body;
+        std::string etag;
+        std::string lastModified;
+        std::chrono::steady_clock::time_point fetchedAt;
+        bool fetching = false;
+
+        // Content-Length from the last HEAD, until a full copy is cached
+        std::optional<size_t> headSize;
+        std::chrono::steady_clock::time_point headAt;
+        bool heading = false;
+    };
+
+    std::shared_ptr<Entry> getEntry(const std::string &url);
+
+    // Starts a (conditional) fetch. Called with entry->mutex held.
+    void startFetch(const std::string &url, const std::shared_ptr<Entry> &entry);
+
+    // Starts a HEAD for url's size. Called with entry->mutex held.
+    void startHead(const std::string &url, const std::shared_ptr<Entry> &entry);
+
+    IStreamingClient &client_;
+    std::chrono::seconds ttl_{300};
+    ChangeCallback onChange_;
+    std::shared_ptr<DiskStore> store_;
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<Entry>> entries_;
+};
@@ -7,19 +7,65 @@
 #include <condition_variable>
 #include <string>
 #include <vector>
+#include <deque>
+#include <atomic>
+
+// Session and loop tuning, from the "fuse" object in smconfig.json.
+// Capabilities are only requested; the init callback drops whatever the
+// kernel does not offer.
+struct FuseOptions
+{
+    // Largest read and write request in bytes. max_write also sets the
+    // negotiated max_pages, which bounds reads as well (the kernel's own
+    // default is 32 pages). 0 leaves the libfuse default.
+    unsigned maxRead = 1024 * 1024;
+    unsigned maxWrite = 1024 * 1024;
+    unsigned maxReadahead = 1024 * 1024;
+    // Outstanding background (readahead, async) requests the kernel may queue
+    unsigned maxBackground = 64;
+
+    bool asyncRead = true;
+    // Replies through a pipe when the data sits in a file descriptor
+    bool spliceWrite = true;
+    // Only negotiated: no reply passes FUSE_BUF_SPLICE_MOVE, since the
+    // ring's pages stay in use
+    bool spliceMove = false;
+    // Request bodies through a pipe; only pays off with a write_buf handler
+    bool spliceRead = false;
+    // Lets the kernel batch writes to user files in cacheDir
+    bool writebackCache = false;
+
+    // Worker threads: each gets its own /dev/fuse descriptor with cloneFd,
+    // and idle workers beyond maxIdleThreads exit.
+    bool cloneFd = true;
+    unsigned maxIdleThreads = 10;
+};
 
 class FuseManager
 {
 public:
-    FuseManager(const std::string &mountPoint);
+    FuseManager(const std::string &mountPoint, const FuseOptions &options = {});
     ~FuseManager();
 
     bool Initialize(bool debugMode);
     void Run();
     void Stop();
 
+    // Queues a drop of the kernel's cached pages and attributes for ino.
+    // Safe to call from any thread, including ones a FUSE read waits on.
+    void InvalidateInode(fuse_ino_t ino);
+
+    // Queues a drop of the kernel's dentry for name in directory parent.
+    void InvalidateEntry(fuse_ino_t parent, const std::string &name);
+
+    // Whether the kernel agreed to spliced replies (FUSE_CAP_SPLICE_WRITE).
+    // Operations reach the manager through fuse_req_userdata.
+    bool SpliceWrite() const { return spliceWrite_; }
+
 private:
     std::string mountPoint_;
+    FuseOptions options_;
+    std::atomic<bool> spliceWrite_{false};
 
     struct fuse_session *session_;
     std::thread fuseThread_;
@@ -27,5 +73,22 @@ private:
     std::condition_variable exitCondition_;
     bool exitRequested_;
 
+    // fuse_lowlevel_notify_inval_inode can block on page locks held by
+    // in-flight reads, so notifications go out from their own thread.
+    std::thread notifyThread_;
+    std::mutex notifyMutex_;
+    std::condition_variable notifyCondition_;
+    struct Notification
+    {
+        fuse_ino_t ino;
+        std::string name; // Set for entry invalidations; ino is the parent
+    };
+    std::deque<Notification> notifyQueue_;
+    bool notifyStop_ = false;
+
     void FuseLoop();
+    void NotifyLoop();
+
+    // fuse_lowlevel_ops::init; userdata is the FuseManager
+    static void OnInit(void *userdata, struct fuse_conn_info *conn);
 };
@@ -3,22 +3,25 @@
 #define FUSE_USE_VERSION 35
 
 #include <fuse3/fuse_lowlevel.h> // For low-level FUSE operations
-#include <unordered_map>
-#include <atomic>
+#include "inode_table.hpp"
+#include <string>
+#include <string_view>
 
 // Global state
-extern std::unordered_map<std::string, fuse_ino_t> pathToInode;
-extern std::unordered_map<fuse_ino_t, std::string> inodeToPath;
-extern std::atomic<fuse_ino_t> nextInode;
+extern InodeTable inodeTable;
 
 void fs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name);
+void fs_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup);
+void fs_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets);
 void fs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
 void fs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi);
+void fs_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi);
 
 void fs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
 void fs_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi);
 void fs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
 void fs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi);
+void fs_poll(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi, struct fuse_pollhandle *ph);
 
 void fs_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
 void fs_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
@@ -27,4 +30,32 @@ void fs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, s
 void fs_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size);
 void fs_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev);
 
+// Shorthand for inodeTable.get(path)
 fuse_ino_t getInode(const std::string &path);
+
+// Replies with an entry whose inode was already counted with
+// inodeTable.ref(), dropping that count again if the reply fails.
+void replyEntry(fuse_req_t req, const struct fuse_entry_param &e);
+
+struct VirtualFile;
+
+// Attributes of a catalog entry (vf == nullptr for directories). name is
+// only used for its extension.
+void fillVirtualAttr(struct stat &st, fuse_ino_t ino, const std::string &name, const VirtualFile *vf);
+
+// How long the kernel may cache entries and attributes of files in
+// cacheDir, which can change behind our back. Catalog entries use
+// SMFS::entryTimeout / attrTimeout.
+constexpr double UserFileTimeout = 1.0;
+
+// Directory in cacheDir's root holding SMFS's own data (content copies,
+// the catalog snapshot). cacheDir is served through the mount; this one
+// never is.
+constexpr std::string_view PrivateDirName = ".smfs";
+
+// Whether a mount path is PrivateDirName or below it
+bool isPrivatePath(std::string_view path);
+
+// Cache lifetimes for a catalog entry (vf == nullptr for directories)
+double entryTimeoutFor(const VirtualFile *vf);
+double attrTimeoutFor(const VirtualFile *vf);
@@ -1,11 +1,33 @@
 // File: i_streaming_client.hpp
 #pragma once
 #include <string>
+#include <string_view>
 #include <functional>
+#include <vector>
+
+struct FetchResult
+{
+    bool ok = false;  // Transfer finished and the server answered < 400
+    long status = 0;  // HTTP status code
+    std::string error; // Transport or HTTP error description
+    long long contentLength = -1; // Content-Length, -1 if the server sent none
+
+    // Validators from the response, for conditional revalidation
+    std::string etag;
+    std::string lastModified;
+};
 
 class IStreamingClient
 {
 public:
-    virtual void fetchStreamAsync(const std::string &url, std::function<void(const std::string &data)> onDataReceived) = 0;
+    // Called for every chunk as it arrives; return false to abort the transfer.
+    using ChunkCallback = std::function<bool(std::string_view chunk)>;
+    using CompleteCallback = std::function<void(const FetchResult &result)>;
+
+    // headers are extra request headers, e.g. "If-None-Match: <etag>".
+    virtual void fetchStreamAsync(const std::string &url, ChunkCallback onChunk, CompleteCallback onComplete = nullptr,
+                                  const std::vector<std::string> &headers = {}) = 0;
+    // Issues a HEAD request; only the result is reported.
+    virtual void headAsync(const std::string &url, CompleteCallback onComplete) = 0;
     virtual ~IStreamingClient() = default;
 };
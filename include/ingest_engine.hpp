@@ -0,0 +1,97 @@
+// File: ingest_engine.hpp
+#pragma once
+#include <curl/curl.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <future>
+#include <functional>
+#include <unordered_map>
+#include <chrono>
+#include <string>
+
+// Drives every live upstream stream from one thread using
+// curl_multi_socket_action and epoll, instead of one blocking
+// curl_easy_perform thread per channel.
+//
+// All curl calls happen on the engine thread; other threads talk to it
+// through a command queue woken by an eventfd.
+class IngestEngine
+{
+public:
+    // Called when a transfer ends. Return true to retry after retryDelay.
+    using DoneCallback = std::function<bool(CURLcode result)>;
+
+    using StreamId = uint64_t;
+
+    IngestEngine();
+    ~IngestEngine();
+
+    IngestEngine(const IngestEngine &) = delete;
+    IngestEngine &operator=(const IngestEngine &) = delete;
+
+    // Starts fetching url. write/userdata are installed as the curl write
+    // callback; it may return CURL_WRITEFUNC_PAUSE to apply backpressure.
+    StreamId addStream(const std::string &url, curl_write_callback write, void *userdata, DoneCallback onDone);
+
+    // Resumes a stream whose write callback paused it.
+    void resumeStream(StreamId id);
+
+    // Cancels a stream. Once this returns, its callbacks will not run again.
+    void removeStream(StreamId id);
+
+    static constexpr std::chrono::seconds retryDelay{5};
+
+private:
+    struct Stream
+    {
+        std::string url;
+        CURL *easy = nullptr;
+        curl_write_callback write = nullptr;
+        void *userdata = nullptr;
+        DoneCallback onDone;
+        bool active = false;
+        std::chrono::steady_clock::time_point retryAt;
+    };
+
+    struct Command
+    {
+        enum class Type
+        {
+            Add,
+            Resume,
+            Remove
+        } type;
+        StreamId id;
+        std::shared_ptr<Stream> stream;
+        std::shared_ptr<std::promise<void>> done;
+    };
+
+    static int socketCallback(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp);
+    static int timerCallback(CURLM *multi, long timeoutMs, void *userp);
+
+    void post(Command command);
+    void eventLoop();
+    void processCommands();
+    void activate(StreamId id, Stream &stream);
+    void deactivate(Stream &stream);
+    void processCompletions();
+    void processRetries();
+    int nextWaitMs() const;
+
+    CURLM *multiHandle_;
+    int epollFd_;
+    int wakeFd_;
+    std::thread workerThread_;
+    std::atomic<bool> isRunning_{true};
+    std::atomic<StreamId> nextId_{1};
+
+    // Engine thread only
+    std::unordered_map<StreamId, std::shared_ptr<Stream>> streams_;
+    std::chrono::steady_clock::time_point timerDeadline_;
+    bool timerArmed_ = false;
+
+    std::mutex mutex_;
+    std::deque<Command> commands_;
+};
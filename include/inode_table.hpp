@@ -0,0 +1,99 @@
+// File: inode_table.hpp
+#pragma once
+#define FUSE_USE_VERSION 35
+#include <fuse3/fuse_lowlevel.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// Path <-> inode mapping shared by all FUSE worker threads.
+//
+// Inode numbers are derived from a hash of the path, so a path keeps its
+// number across reloads and restarts and clients caching by inode (media
+// servers, NFS re-exports) see the same file. A path whose hash is taken
+// by another live path probes for the next free number; the catalog
+// snapshot records the numbers actually used so that choice survives a
+// restart too.
+//
+// Both directions are split into independently locked shards, so lookups
+// on different inodes or paths rarely contend, and readers never block
+// each other. An inode lives while the kernel holds references to it
+// (counted by ref() and released by forget()) or while something pins it,
+// such as the catalog entry it belongs to. When both drop to zero it is
+// removed, which keeps the table bounded across reloads.
+class InodeTable
+{
+public:
+    InodeTable();
+
+    InodeTable(const InodeTable &) = delete;
+    InodeTable &operator=(const InodeTable &) = delete;
+
+    // The inode for path, allocating one if it has none. A new inode gets
+    // preferred if that is free, otherwise the number derived from path.
+    fuse_ino_t get(const std::string &path, fuse_ino_t preferred = 0);
+
+    // The number path gets when nothing else holds it
+    static fuse_ino_t stableInode(const std::string &path);
+
+    std::optional<fuse_ino_t> find(const std::string &path) const;
+    std::optional<std::string> path(fuse_ino_t ino) const;
+
+    // The kernel received one more reference (fuse_reply_entry, or a
+    // readdirplus entry other than "." and ".."). Returns false if ino no
+    // longer exists.
+    bool ref(fuse_ino_t ino);
+
+    // The kernel dropped nlookup references (forget/forget_multi).
+    void forget(fuse_ino_t ino, uint64_t nlookup);
+
+    // Keeps ino alive independently of the kernel's references.
+    void pin(fuse_ino_t ino);
+    void unpin(fuse_ino_t ino);
+
+    size_t size() const;
+
+private:
+    static constexpr size_t ShardCount = 64;
+
+    struct Record
+    {
+        std::string path;
+        uint64_t lookups = 0;
+        uint32_t pins = 0;
+    };
+
+    struct alignas(64) InodeShard
+    {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<fuse_ino_t, Record> records;
+    };
+
+    struct alignas(64) PathShard
+    {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, fuse_ino_t> inodes;
+    };
+
+    InodeShard &inodeShard(fuse_ino_t ino) { return inodeShards_[ino % ShardCount]; }
+    const InodeShard &inodeShard(fuse_ino_t ino) const { return inodeShards_[ino % ShardCount]; }
+    PathShard &pathShard(const std::string &path) { return pathShards_[std::hash<std::string>()(path) % ShardCount]; }
+    const PathShard &pathShard(const std::string &path) const { return pathShards_[std::hash<std::string>()(path) % ShardCount]; }
+
+    // True if ino is live and belongs to path
+    bool ownedBy(fuse_ino_t ino, const std::string &path) const;
+
+    // Drops a record whose last reference went away. Called without locks;
+    // the path mapping is only removed if it still points at ino and ino
+    // was not handed out to path again in the meantime.
+    void remove(const std::string &path, fuse_ino_t ino);
+
+    // Locks are always taken path shard first, then inode shard.
+    std::array<InodeShard, ShardCount> inodeShards_;
+    std::array<PathShard, ShardCount> pathShards_;
+    std::atomic<size_t> size_{0};
+};
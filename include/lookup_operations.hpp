@@ -5,4 +5,6 @@
 #include <string>
 
 void fs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name);
-void fs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
\ No newline at end of file
+void fs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+void fs_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup);
+void fs_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets);
@@ -0,0 +1,75 @@
+// File: negative_lookup_cache.hpp
+#pragma once
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Remembers names that were looked up under cacheDir and did not exist, so
+// repeated probes (.nfo, posters, subtitles) skip the lstat.
+//
+// Entries expire after the TTL. Where inotify is available, the nearest
+// existing directory above each miss is watched, and anything created or
+// moved into it drops the misses at and below that name straight away.
+// The kernel is told the same misses as negative dentries with the same
+// lifetime, and the callback lets those be invalidated too.
+class NegativeLookupCache
+{
+public:
+    // Called from the watcher thread with the misses an inotify event
+    // dropped (paths relative to cacheDir, as looked up).
+    using DropCallback = std::function<void(const std::vector<std::string> &paths)>;
+
+    NegativeLookupCache() = default;
+    ~NegativeLookupCache();
+
+    NegativeLookupCache(const NegativeLookupCache &) = delete;
+    NegativeLookupCache &operator=(const NegativeLookupCache &) = delete;
+
+    // A ttl of zero disables the cache. Call once, before the first lookup.
+    void start(const std::string &cacheDir, std::chrono::milliseconds ttl, DropCallback onDrop);
+    void stop();
+
+    std::chrono::milliseconds ttl() const { return ttl_; }
+
+    // True if path (e.g. "/group/foo.nfo") is known not to exist
+    bool isMissing(const std::string &path) const;
+
+    // Records that path does not exist under cacheDir
+    void addMiss(const std::string &path);
+
+    // path was created through the mount
+    void erase(const std::string &path);
+
+private:
+    static constexpr size_t MaxEntries = 65536;
+
+    using Clock = std::chrono::steady_clock;
+
+    // Watches the nearest existing ancestor of path. Called with mutex_ held.
+    void watchAncestor(const std::string &path);
+
+    // Drops every miss at or below path. Called with mutex_ held.
+    void dropTree(const std::string &path, std::vector<std::string> &dropped);
+
+    void watchLoop();
+
+    std::string cacheDir_;
+    std::chrono::milliseconds ttl_{0};
+    DropCallback onDrop_;
+
+    mutable std::shared_mutex mutex_;
+    // Ordered, so everything below a directory is one range
+    std::map<std::string, Clock::time_point> misses_;
+    std::unordered_map<int, std::string> watches_; // wd -> path
+    std::unordered_map<std::string, int> watchedDirs_;
+
+    int inotifyFd_ = -1;
+    int stopFd_ = -1;
+    std::thread watchThread_;
+};
@@ -1,86 +1,217 @@
 // File: pipe.hpp
 #pragma once
-#include <queue>
 #include <mutex>
 #include <condition_variable>
-#include <vector>
 #include <atomic>
-#include "logger.hpp"
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <algorithm>
+#include <streambuf>
 
+// Fixed-capacity byte ring.
+//
+// The common case is one producer (the curl write callback) and one consumer
+// (a FUSE read), which runs lock-free: the producer only advances tail_, the
+// consumer only advances head_, and data is moved with at most two memcpy
+// spans per batch. The mutex/condition variable pair is only touched when a
+// side actually has to sleep. Additional concurrent producers or consumers are
+// serialized against each other by writeMutex_/readMutex_ so the SPSC core
+// stays correct.
 class Pipe
 {
 public:
-    explicit Pipe(size_t capacity) : capacity_(capacity) {}
+    // Capacity is rounded up to the next power of two.
+    explicit Pipe(size_t capacity)
+        : capacity_(roundUpPow2(capacity)), mask_(capacity_ - 1), buffer_(new char[capacity_]) {}
 
-    // Producer writes data into the pipe
+    size_t capacity() const { return capacity_; }
+
+    size_t size() const
+    {
+        return static_cast<size_t>(tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire));
+    }
+
+    // Producer writes data into the pipe. Blocks while the pipe is full.
+    // Returns false if stop was requested before all bytes were written.
     bool write(const char *data, size_t len, std::atomic<bool> &stop)
     {
-        std::unique_lock<std::mutex> lock(mutex_);
+        std::lock_guard<std::mutex> writerLock(writeMutex_);
         size_t written = 0;
 
-        while (written < len && !stop.load())
+        while (written < len)
         {
-            while (queue_.size() >= capacity_ && !stop.load())
-                condNotFull_.wait(lock);
-
             if (stop.load())
                 return false;
 
-            size_t batchSize = std::min(capacity_ - queue_.size(), len - written);
-            for (size_t i = 0; i < batchSize; ++i)
-                queue_.push(data[written + i]);
+            const uint64_t tail = tail_.load(std::memory_order_relaxed);
+            const uint64_t head = head_.load(std::memory_order_acquire);
+            size_t space = capacity_ - static_cast<size_t>(tail - head);
+
+            if (space == 0)
+            {
+                waitFor(writerWaiting_, [&]
+                        { return tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire) < capacity_; },
+                        stop);
+                continue;
+            }
+
+            size_t batch = std::min(space, len - written);
+            copyIn(tail, data + written, batch);
+            tail_.store(tail + batch, std::memory_order_release);
+            written += batch;
 
-            written += batchSize;
-            condNotEmpty_.notify_one();
+            wake(readerWaiting_);
         }
 
         return true;
     }
 
-    // Consumer reads data from the pipe
+    // Consumer reads data from the pipe. Blocks until len bytes have been
+    // read, or returns fewer once stop is requested and the pipe has drained.
     size_t read(char *dest, size_t len, std::atomic<bool> &stop)
     {
-        std::unique_lock<std::mutex> lock(mutex_);
+        return readImpl(dest, len, stop, false);
+    }
+
+    // Like read(), but returns as soon as at least one byte was read.
+    size_t readSome(char *dest, size_t len, std::atomic<bool> &stop)
+    {
+        return readImpl(dest, len, stop, true);
+    }
+
+    // Wakes any blocked reader or writer so it can re-check its stop flag.
+    void wakeAll()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cond_.notify_all();
+    }
+
+private:
+    static size_t roundUpPow2(size_t v)
+    {
+        size_t p = 1;
+        while (p < v)
+            p <<= 1;
+        return p;
+    }
+
+    size_t readImpl(char *dest, size_t len, std::atomic<bool> &stop, bool partial)
+    {
+        std::lock_guard<std::mutex> readerLock(readMutex_);
         size_t bytesRead = 0;
 
         while (bytesRead < len)
         {
-            if (stop.load() && queue_.empty())
-            {
-                Logger::Log(LogLevel::TRACE, "Pipe::read: Returning EOF. Pipe is empty and stop is requested.");
-                break;
-            }
+            const uint64_t head = head_.load(std::memory_order_relaxed);
+            const uint64_t tail = tail_.load(std::memory_order_acquire);
+            size_t available = static_cast<size_t>(tail - head);
 
-            if (!queue_.empty())
-            {
-                dest[bytesRead++] = queue_.front();
-                queue_.pop();
-                condNotFull_.notify_one();
-            }
-            else
+            if (available == 0)
             {
-                Logger::Log(LogLevel::TRACE, "Pipe::read: Waiting for data in the queue.");
-                condNotEmpty_.wait(lock, [&]
-                                   { return !queue_.empty() || stop.load(); });
+                if (stop.load() || (partial && bytesRead > 0))
+                    break;
+
+                waitFor(readerWaiting_, [&]
+                        { return tail_.load(std::memory_order_acquire) != head_.load(std::memory_order_relaxed); },
+                        stop);
+                continue;
             }
-        }
 
-        Logger::Log(LogLevel::TRACE, "Pipe::read: Read " + std::to_string(bytesRead) + " bytes. Requested: " + std::to_string(len));
-        if (bytesRead > 0)
-        {
-            // Logger::Log(LogLevel::DEBUG, "Pipe::read: Read " + std::to_string(bytesRead) + " bytes. Buffer filled partially/completely.");
+            size_t batch = std::min(available, len - bytesRead);
+            copyOut(head, dest + bytesRead, batch);
+            head_.store(head + batch, std::memory_order_release);
+            bytesRead += batch;
+
+            wake(writerWaiting_);
         }
-        else
+
+        return bytesRead;
+    }
+
+    void copyIn(uint64_t pos, const char *src, size_t len)
+    {
+        size_t offset = static_cast<size_t>(pos) & mask_;
+        size_t first = std::min(len, capacity_ - offset);
+        std::memcpy(buffer_.get() + offset, src, first);
+        std::memcpy(buffer_.get(), src + first, len - first);
+    }
+
+    void copyOut(uint64_t pos, char *dest, size_t len) const
+    {
+        size_t offset = static_cast<size_t>(pos) & mask_;
+        size_t first = std::min(len, capacity_ - offset);
+        std::memcpy(dest, buffer_.get() + offset, first);
+        std::memcpy(dest + first, buffer_.get(), len - first);
+    }
+
+    // Sleeps until ready() holds or stop is set. The waiting flag is raised
+    // before the final check so a concurrent wake() cannot be lost; the timed
+    // wait bounds how long a stop flag set without wakeAll() goes unnoticed.
+    template <typename Ready>
+    void waitFor(std::atomic<bool> &waiting, Ready ready, std::atomic<bool> &stop)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        waiting.store(true, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!ready() && !stop.load())
+            cond_.wait_for(lock, std::chrono::milliseconds(100));
+        waiting.store(false, std::memory_order_relaxed);
+    }
+
+    // Signals the other side once per batch, and only if it is asleep.
+    void wake(std::atomic<bool> &waiting)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed))
         {
-            Logger::Log(LogLevel::TRACE, "Pipe::read: Returning 0 bytes. Pipe is empty.");
+            std::lock_guard<std::mutex> lock(mutex_);
+            cond_.notify_all();
         }
-        return bytesRead;
     }
 
-private:
-    std::queue<char> queue_;
-    size_t capacity_;
+    const size_t capacity_;
+    const size_t mask_;
+    std::unique_ptr<char[]> buffer_;
+
+    alignas(64) std::atomic<uint64_t> head_{0};
+    alignas(64) std::atomic<uint64_t> tail_{0};
+
+    std::atomic<bool> readerWaiting_{false};
+    std::atomic<bool> writerWaiting_{false};
     std::mutex mutex_;
-    std::condition_variable condNotEmpty_;
-    std::condition_variable condNotFull_;
+    std::condition_variable cond_;
+    std::mutex writeMutex_;
+    std::mutex readMutex_;
+};
+
+// std::streambuf over the consumer side of a Pipe, so stream-based parsers
+// can consume data while the producer is still writing it. End of input is
+// reached once eof is set and the pipe has drained.
+class PipeStreamBuf : public std::streambuf
+{
+public:
+    PipeStreamBuf(Pipe &pipe, std::atomic<bool> &eof, size_t bufferSize = 64 * 1024)
+        : pipe_(pipe), eof_(eof), buffer_(new char[bufferSize]), bufferSize_(bufferSize) {}
+
+protected:
+    int_type underflow() override
+    {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+
+        size_t n = pipe_.readSome(buffer_.get(), bufferSize_, eof_);
+        if (n == 0)
+            return traits_type::eof();
+
+        setg(buffer_.get(), buffer_.get(), buffer_.get() + n);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    Pipe &pipe_;
+    std::atomic<bool> &eof_;
+    std::unique_ptr<char[]> buffer_;
+    size_t bufferSize_;
 };
@@ -1,7 +1,6 @@
 // File: sgfs.hpp
 #pragma once
 #include <string>
-#include <vector>
 
 class SMFile
 {
@@ -19,14 +18,8 @@ class SGFS
 public:
     std::string name;
     std::string url;
-    std::vector<SMFile> smFiles;
 
     SGFS() = default;
     SGFS(const std::string &n, const std::string &u)
         : name(n), url(u) {}
-
-    void addSMFile(const SMFile &file)
-    {
-        smFiles.push_back(file);
-    }
 };
@@ -12,6 +12,11 @@
 #include <condition_variable>
 #include <set>
 #include "stream_manager.hpp"
+#include "ingest_engine.hpp"
+#include "async_curl_client.hpp"
+#include "content_cache.hpp"
+#include "catalog.hpp"
+#include "negative_lookup_cache.hpp"
 
 extern std::atomic<bool> exitRequested;
 
@@ -23,8 +28,12 @@ struct VirtualFile
 {
     std::string url;
 
-    // A StreamManager pointer for indefinite streaming
-    std::unique_ptr<StreamManager> streamContext;
+    // A StreamManager pointer for indefinite streaming. Open handles hold
+    // their own reference, so reads never need to go through this field.
+    // Guarded by streamMutex; the rest of the file is immutable once it is
+    // in a published catalog.
+    std::shared_ptr<StreamManager> streamContext;
+    std::mutex streamMutex;
 
     bool isUserFile = false;
     mode_t st_mode = 0111; // default
@@ -54,13 +63,39 @@ struct VirtualFile
         }
     }
 
-    // No copy
+    // No copy or move; shared through shared_ptr
     VirtualFile(const VirtualFile &) = delete;
     VirtualFile &operator=(const VirtualFile &) = delete;
+};
+
+// Per-open state, stored in fuse_file_info::fh
+struct FileHandle
+{
+    std::shared_ptr<VirtualFile> file;
+
+    // Stream and cursor into its ring (.ts only)
+    std::shared_ptr<StreamManager> stream;
+    std::shared_ptr<StreamRing::Reader> reader;
 
-    // Move
-    VirtualFile(VirtualFile &&) = default;
-    VirtualFile &operator=(VirtualFile &&) = default;
+    // Version of the document this handle reads (.xml/.m3u only)
+    std::shared_ptr<const ContentCache::Body> content;
+
+    explicit FileHandle(std::shared_ptr<VirtualFile> f)
+        : file(std::move(f)) {}
+};
+
+// Per-opendir listing, stored in fuse_file_info::fh. Taken once at opendir
+// so readdir offsets (index + 1) stay valid across pages even if a reload
+// changes the directory meanwhile.
+struct DirHandle
+{
+    struct Entry
+    {
+        std::string name;
+        fuse_ino_t ino;
+        std::shared_ptr<VirtualFile> file; // nullptr for directories
+    };
+    std::vector<Entry> entries;
 };
 
 // SMFS = "Stream Master File System"
@@ -69,12 +104,31 @@ struct SMFS
     std::atomic<bool> isShuttingDown{false};
     std::set<std::string> enabledFileTypes;
     std::string cacheDir;
-    // Map of path -> VirtualFile (or nullptr if directory)
-    std::map<std::string, std::shared_ptr<VirtualFile>> files;
-    std::mutex filesMutex;
+    SlowReaderPolicy slowReaderPolicy = SlowReaderPolicy::Skip;
+    // Seconds the kernel may cache catalog entries and their attributes.
+    // Catalog changes are pushed to the kernel, so these can be long.
+    double entryTimeout = 60.0;
+    double attrTimeout = 60.0;
+    // Path -> VirtualFile (or nullptr if directory), plus the directory
+    // tree. Readers load() the current version and use it without locking.
+    std::atomic<std::shared_ptr<const Catalog>> catalog{std::make_shared<const Catalog>()};
+    // Serialises catalog writers
+    std::mutex catalogWriteMutex;
+
+    // Names known to be absent from cacheDir
+    NegativeLookupCache negativeCache;
 
     APIClient apiClient;
 
+    // Multiplexes every live .ts upstream on one thread
+    IngestEngine ingestEngine;
+
+    // Process-wide client for everything that is not a live stream
+    AsyncCurlClient httpClient;
+
+    // .xml / .m3u content, downloaded once and served from memory
+    ContentCache contentCache{httpClient};
+
     SMFS(const std::string &host,
          const std::string &port,
          const std::string &apiKey,
@@ -84,6 +138,19 @@ struct SMFS
     {
     }
 
+    // Applies edit to a copy of the current catalog and publishes it. The
+    // copy shares every catalog shard the edit leaves alone, so its cost
+    // follows the size of the edit; readers keep whichever version they
+    // loaded.
+    template <typename Edit>
+    void updateCatalog(Edit &&edit)
+    {
+        std::lock_guard<std::mutex> lock(catalogWriteMutex);
+        auto next = std::make_shared<Catalog>(*catalog.load());
+        edit(*next);
+        catalog.store(std::move(next));
+    }
+
     // Non-copyable
     SMFS(const SMFS &) = delete;
     SMFS &operator=(const SMFS &) = delete;
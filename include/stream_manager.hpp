@@ -1,47 +1,98 @@
 // File: stream_manager.hpp
 #pragma once
-#include "pipe.hpp"
-#include "i_streaming_client.hpp"
-#include <thread>
+#include "stream_ring.hpp"
+#include "ingest_engine.hpp"
 #include <atomic>
 #include <string>
 #include <mutex>
 #include <memory>
+#include <deque>
+#include <functional>
+#include <vector>
+#include <sys/types.h>
 
 class StreamManager
 {
 public:
-    explicit StreamManager(const std::string &url, size_t bufferCapacity, std::shared_ptr<IStreamingClient> client, std::atomic<bool> &shutdownFlag);
+    // Completes a read with its bytes (0 at end of stream) or a negative
+    // errno. data points into the ring, which keeps it pinned only for the
+    // length of the call: reply from it directly, never keep it.
+    using ReadCallback = std::function<void(const StreamRing::Span &data, ssize_t result)>;
 
-    void incrementReaderCount();
-    void decrementReaderCount();
+    // Runs once when a polled cursor becomes readable
+    using WakeCallback = std::function<void()>;
 
+    // A parked read is answered once this much (or all it asked for) is in
+    static constexpr size_t MinReplyBytes = 32 * 1024;
+
+    explicit StreamManager(const std::string &url, size_t bufferCapacity, SlowReaderPolicy policy, IngestEngine &engine, std::atomic<bool> &shutdownFlag);
+
+    // Each open handle gets its own cursor into the shared ring.
+    std::shared_ptr<StreamRing::Reader> openReader();
+    void closeReader(const std::shared_ptr<StreamRing::Reader> &reader);
+
+    // Registers / cancels the upstream transfer with the shared ingest engine.
     void startStreaming();
     void stopStreaming();
-    void startStreamingThread();
-    void stopStreamingThread();
+
+    // Reads through a handle's cursor without blocking the caller. If enough
+    // is buffered, complete runs right away on the calling thread; otherwise
+    // the read is parked and completed from the ingest thread as data
+    // arrives, or with EOF when the stream stops or the reader closes.
+    // Reads on one cursor complete in the order they were made.
+    //
+    // With wait unset (O_NONBLOCK), any buffered data is returned right
+    // away and an empty ring completes the read with -EAGAIN instead.
+    void readAsync(const std::shared_ptr<StreamRing::Reader> &reader, size_t size, ReadCallback complete, bool wait = true);
+
+    // True if a read through reader would not wait. Otherwise onReady is
+    // armed to run once, from the ingest thread, when it becomes readable;
+    // a later poll on the same cursor replaces it (dropped without running).
+    bool poll(const std::shared_ptr<StreamRing::Reader> &reader, WakeCallback onReady);
 
     const std::string &getUrl() const;
-    Pipe &getPipe();
     bool isStopped() const;
-
-    size_t readContent(const std::string &toFetchUrl, char *buf, size_t size, off_t offset);
+    // The upstream transfer ended; readers only drain what is buffered
+    bool isFinished() const;
 
     ~StreamManager();
 
 private:
     static size_t writeCallback(char *ptr, size_t size, size_t nmemb, void *userdata);
-    static size_t WriteCallback(void *contents, size_t size, size_t nmemb, void *userp);
 
-    size_t fetchUrlContent(const std::string &url, char *buf, size_t size, off_t offset);
-    void streamingThreadFunc();
+    bool onTransferDone(CURLcode result);
+    void resumeIfPaused();
+
+    struct ParkedRead
+    {
+        std::shared_ptr<StreamRing::Reader> reader;
+        size_t size;
+        ReadCallback complete;
+    };
+
+    // Completes read if at least minBytes (or all it asked for) are
+    // buffered; minBytes 0 answers it with whatever is there. Called with
+    // parkedMutex_ held.
+    bool tryComplete(ParkedRead &read, size_t minBytes);
+
+    // Completes the parked reads that can be answered now (all of them with
+    // flush, or only those of reader if given) and wakes readable pollers.
+    void serveParked(bool flush, const StreamRing::Reader *reader = nullptr);
 
     std::string url_;
-    Pipe pipe_;
-    std::shared_ptr<IStreamingClient> client_;
-    std::jthread streamingThread_;
+    StreamRing ring_;
+    IngestEngine &engine_;
+    IngestEngine::StreamId streamId_ = 0;
+    std::atomic<bool> paused_{false};
     std::atomic<int> readerCount_{0};
     std::atomic<bool> stopRequested_{false};
+    std::atomic<bool> finished_{false};
     std::mutex mutex_;
     std::atomic<bool> &isShuttingDown_;
+
+    std::mutex parkedMutex_;
+    std::deque<ParkedRead> parked_;
+    std::vector<std::pair<const StreamRing::Reader *, WakeCallback>> pollers_;
+    // Lets the ingest thread skip the lock when nothing is parked or polled
+    std::atomic<bool> hasParked_{false};
 };
@@ -0,0 +1,132 @@
+// File: stream_ring.hpp
+#pragma once
+#include "ts_tracker.hpp"
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// What the writer does when a reader falls a full ring behind.
+enum class SlowReaderPolicy
+{
+    Block,     // Writer pauses for the slowest reader (stalls the upstream).
+    Skip,      // Reader jumps ahead to the oldest data still in the ring.
+    Disconnect // Reader is cut off; further reads fail.
+};
+
+SlowReaderPolicy ParseSlowReaderPolicy(const std::string &policyStr);
+
+// Broadcast ring: one upstream writer, any number of readers that each keep
+// their own cursor, so every reader sees the full stream from the point it
+// joined. Positions are absolute byte counts; the byte at position p lives at
+// p % capacity. The writer copies in outside the lock, and a reader it laps
+// has the policy applied before it is handed anything.
+//
+// The buffer is a mapped memfd where the kernel allows it, so replies can
+// splice straight out of it. Readers borrow their bytes in place
+// (peek / consume); the writer never overwrites a borrowed span.
+//
+// Written data is followed as MPEG-TS, so new readers join on a packet
+// boundary, preferably at the latest keyframe, and are first handed the
+// current PAT and PMT.
+class StreamRing
+{
+public:
+    struct Reader
+    {
+        uint64_t pos = 0;
+        std::atomic<bool> disconnected{false};
+        uint64_t skippedBytes = 0;
+        std::mutex readMutex; // Serializes concurrent reads on one handle
+        bool pinned = false;  // A peeked span from pos is still in use
+
+        // PAT and PMT still to be handed out before the byte at pos
+        std::shared_ptr<const std::string> headers;
+        size_t headersSent = 0;
+    };
+
+    // Ring bytes lent out in place: up to two pieces, the second when the
+    // data wraps around the end of the buffer.
+    struct Span
+    {
+        const char *data[2] = {};
+        size_t offset[2] = {}; // Of each piece within fd
+        size_t length[2] = {};
+        size_t pieces = 0;
+        size_t size = 0;
+        int fd = -1; // Backing memfd, -1 if the ring is plain memory
+        bool headers = false; // The reader's PAT/PMT rather than ring data
+    };
+
+    StreamRing(size_t capacity, SlowReaderPolicy policy);
+    ~StreamRing();
+
+    StreamRing(const StreamRing &) = delete;
+    StreamRing &operator=(const StreamRing &) = delete;
+
+    // Registers a reader at the latest keyframe still comfortably inside the
+    // ring, or else on the packet boundary nearest the live edge, with the
+    // current PAT and PMT queued ahead of the stream data. Data that is not
+    // a transport stream is joined at the live edge.
+    std::shared_ptr<Reader> openReader();
+    void closeReader(const std::shared_ptr<Reader> &reader);
+
+    // Appends all of data for every reader, or nothing if the Block policy
+    // or a pinned span leaves too little room; the producer pauses and
+    // retries once readers have moved on.
+    bool tryWrite(const char *data, size_t len);
+
+    // Marks the end of the stream; readers drain what is left and then see EOF.
+    void finish();
+
+    enum class ReadStatus
+    {
+        Data,        // span holds the bytes
+        Pending,     // Fewer than minBytes available yet
+        End,         // Finished and fully drained
+        Disconnected // Cut off for falling behind
+    };
+
+    // Lends up to len bytes in place if at least minBytes are available, or
+    // whatever is left once the stream has finished. On Data, span points at
+    // the bytes in the ring and they stay pinned until consume() moves the
+    // cursor past them; tryWrite fails rather than overwrite them, so keep
+    // the span only for the length of a reply. One peek per reader may be
+    // outstanding.
+    ReadStatus peek(Reader &reader, size_t len, size_t minBytes, Span &span);
+    void consume(Reader &reader, const Span &span);
+
+    // True if a read through reader would not have to wait: data is
+    // available, the stream has finished, or the reader was cut off.
+    bool readable(const Reader &reader) const;
+
+    size_t capacity() const { return capacity_; }
+    SlowReaderPolicy policy() const { return policy_; }
+
+private:
+    uint64_t oldestRetained() const;
+    uint64_t slowestReader() const;
+    size_t freeSpace() const;
+    void disconnectLapped();
+    void append(std::unique_lock<std::mutex> &lock, const char *data, size_t len);
+    void copyIn(uint64_t pos, const char *src, size_t len);
+
+    const size_t capacity_;
+    const SlowReaderPolicy policy_;
+    char *buffer_ = nullptr;
+    int fd_ = -1;
+    std::unique_ptr<char[]> heapBuffer_; // Only if the memfd could not be set up
+
+    // Guarded by mutex_
+    uint64_t writePos_ = 0;   // End of data visible to readers
+    uint64_t reserveEnd_ = 0; // End of the span the writer is copying in
+    std::vector<std::shared_ptr<Reader>> readers_;
+    TsTracker::StartPoint start_; // Where new readers join
+    bool finished_ = false;
+
+    mutable std::mutex mutex_;
+    std::mutex writeMutex_;
+    TsTracker tracker_; // Guarded by writeMutex_
+};
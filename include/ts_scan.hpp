@@ -0,0 +1,47 @@
+// File: ts_scan.hpp
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The 4-byte header of one MPEG-TS packet, rearranged so the fields can be
+// produced for many packets at once: bits 0-12 PID, 16-19 continuity
+// counter, then the flags below.
+struct TsHeader
+{
+    static constexpr uint32_t Error = 1u << 24;     // transport_error_indicator
+    static constexpr uint32_t UnitStart = 1u << 25; // payload_unit_start_indicator
+    static constexpr uint32_t Payload = 1u << 26;
+    static constexpr uint32_t Adaptation = 1u << 27;
+
+    uint32_t bits;
+
+    uint16_t pid() const { return static_cast<uint16_t>(bits & 0x1FFF); }
+    uint8_t cc() const { return static_cast<uint8_t>((bits >> 16) & 0xF); }
+    bool error() const { return bits & Error; }
+    bool unitStart() const { return bits & UnitStart; }
+    bool hasPayload() const { return bits & Payload; }
+    bool hasAdaptation() const { return bits & Adaptation; }
+};
+static_assert(sizeof(TsHeader) == 4, "kernels store TsHeader arrays as 32-bit lanes");
+
+// Vectorized scanning of transport stream bytes. Every kernel gives the same
+// results; bestTsScanKernel() picks the widest the CPU supports at runtime.
+struct TsScanKernel
+{
+    const char *name;
+
+    // Decodes the headers of count packets laid out back to back from data
+    // into out, and returns how many of them, from the first, begin with a
+    // sync byte. out is only meaningful up to that count.
+    size_t (*decode)(const uint8_t *data, size_t count, TsHeader *out);
+
+    // Offset of the first byte that starts three sync bytes a packet apart,
+    // or len if there is none.
+    size_t (*findSync)(const uint8_t *data, size_t len);
+};
+
+const TsScanKernel &bestTsScanKernel();
+
+// All kernels this CPU can run, narrowest (scalar) first
+std::vector<const TsScanKernel *> supportedTsScanKernels();
@@ -0,0 +1,80 @@
+// File: ts_tracker.hpp
+#pragma once
+#include "ts_scan.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+// Follows an MPEG-TS byte stream as it is appended to a StreamRing, so a new
+// reader can start where a player decodes straight away: at the latest
+// keyframe, behind copies of the current PAT and PMT. Positions are absolute
+// byte counts of the stream, as in StreamRing. Only the first program of the
+// PAT and the first video stream of its PMT are followed.
+//
+// Packet headers are checked and decoded in batches by the widest
+// TsScanKernel the CPU has; only the few packets that matter (PAT, PMT,
+// video unit starts) are looked at byte by byte.
+//
+// Not thread-safe; the ring feeds it from the writer and publishes
+// startPoint() under its own lock.
+class TsTracker
+{
+public:
+    static constexpr size_t PacketSize = 188;
+    static constexpr uint8_t SyncByte = 0x47;
+
+    struct StartPoint
+    {
+        // False until packets line up, and whenever they stop doing so
+        bool synced = false;
+        // Start of the packet the data currently ends in
+        uint64_t packetStart = 0;
+        // Start of the packet opening the latest random access point
+        std::optional<uint64_t> randomAccess;
+        // The latest PAT and PMT packets, in that order; null until both seen
+        std::shared_ptr<const std::string> headers;
+    };
+
+    // Consumes the next len bytes of the stream.
+    void feed(const char *data, size_t len);
+
+    const StartPoint &startPoint() const { return start_; }
+
+private:
+    enum class Codec
+    {
+        None,
+        Mpeg2,
+        H264,
+        Hevc,
+        Other // Video we only know keyframes of through the adaptation field
+    };
+
+    static constexpr uint16_t NoPid = 0x1FFF;
+    static constexpr size_t Batch = 64; // Packets decoded at a time
+
+    void search();
+    void scan(const uint8_t *bytes, size_t len, uint64_t pos);
+    void lostSync(const uint8_t *bytes, size_t len, uint64_t pos);
+    void parsePacket(const uint8_t *packet, TsHeader header, uint64_t pos);
+    void parsePat(const uint8_t *packet, size_t payload);
+    void parsePmt(const uint8_t *packet, size_t payload);
+    bool startsKeyframe(const uint8_t *pes, size_t len) const;
+    void publishHeaders();
+
+    const TsScanKernel &kernel_ = bestTsScanKernel();
+
+    uint64_t pos_ = 0;      // Stream bytes fed so far
+    std::string carry_;     // A partial packet, or bytes being searched for sync
+    uint64_t carryPos_ = 0; // Stream position of carry_[0]
+    StartPoint start_;
+
+    uint16_t pmtPid_ = NoPid;
+    uint16_t videoPid_ = NoPid;
+    Codec codec_ = Codec::None;
+    int videoCc_ = -1; // Continuity counter of the last video packet with payload
+    std::string pat_;
+    std::string pmt_;
+};
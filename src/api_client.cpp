@@ -3,17 +3,38 @@
 #include <curl/curl.h>
 #include <nlohmann/json.hpp>
 #include <stdexcept>
+#include <istream>
 #include "logger.hpp"
 #include "smfs_state.hpp"
+#include "catalog_parser.hpp"
+#include "catalog_snapshot.hpp"
+#include "fuse_operations.hpp"
+#include "pipe.hpp"
 
 using json = nlohmann::json;
 
-// Callback to write response data
+// Curl hands the response to the parser through a Pipe of this size, so
+// the response is never held in full.
+static constexpr size_t CatalogPipeSize = 1024 * 1024;
+
+struct CatalogTransfer
+{
+    Pipe &pipe;
+    std::atomic<bool> &abort;
+    size_t bytes = 0;
+};
+
+// Runs on the transfer thread; blocks while the parser is behind.
 static size_t write_response(void *ptr, size_t size, size_t nmemb, void *userdata)
 {
-    auto *response = reinterpret_cast<std::string *>(userdata);
-    response->append(reinterpret_cast<char *>(ptr), size * nmemb);
-    return size * nmemb;
+    auto *transfer = reinterpret_cast<CatalogTransfer *>(userdata);
+    size_t total = size * nmemb;
+    if (!transfer->pipe.write(reinterpret_cast<char *>(ptr), total, transfer->abort))
+    {
+        return 0; // Parser gave up
+    }
+    transfer->bytes += total;
+    return total;
 }
 
 APIClient::APIClient(const std::string &host,
@@ -38,6 +59,48 @@ const std::map<int, SGFS> &APIClient::getGroups() const
     return groups;
 }
 
+void APIClient::setChangeCallback(ChangeCallback onChange)
+{
+    onChange_ = std::move(onChange);
+}
+
+void APIClient::notifyChanged(const std::vector<std::string> &paths) const
+{
+    if (!paths.empty() && onChange_)
+    {
+        onChange_(paths);
+    }
+}
+
+void APIClient::setSnapshotPath(const std::string &path)
+{
+    snapshotPath_ = path;
+}
+
+bool APIClient::loadSnapshot()
+{
+    std::map<int, SGFS> loadedGroups;
+    std::map<std::string, std::shared_ptr<VirtualFile>> loaded;
+    CatalogSnapshot::Inodes inodes;
+    if (snapshotPath_.empty() || !CatalogSnapshot::load(snapshotPath_, loaded, loadedGroups, inodes))
+    {
+        return false;
+    }
+
+    // Claim the numbers the last run used before anything else is allocated
+    for (const auto &[path, ino] : inodes)
+    {
+        inodeTable.get(path, ino);
+    }
+
+    // Merged like a reload, so later reconciliation is an ordinary diff
+    std::vector<std::string> changed;
+    g_state->updateCatalog([&](Catalog &catalog)
+                           { applyCatalog(catalog, loaded, changed); });
+    groups = std::move(loadedGroups);
+    return true;
+}
+
 void APIClient::fetchFileList()
 {
     Logger::Log(LogLevel::INFO, "Fetching file list from API: " + baseUrl);
@@ -49,22 +112,26 @@ void APIClient::fetchFileList()
     {
         try
         {
-            CURL *curl = curl_easy_init();
-            if (!curl)
-                throw std::runtime_error("CURL initialization failed");
+            // Applied only once the whole response parsed cleanly
+            std::map<int, SGFS> nextGroups;
+            std::map<std::string, std::shared_ptr<VirtualFile>> next;
+            streamCatalog(nextGroups, next);
 
-            std::string response;
-            curl_easy_setopt(curl, CURLOPT_URL, baseUrl.c_str());
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_response);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+            // Saved before merging, while next still holds the whole catalog
+            if (!snapshotPath_.empty())
+            {
+                CatalogSnapshot::save(snapshotPath_, next, nextGroups);
+            }
 
-            CURLcode res = curl_easy_perform(curl);
-            curl_easy_cleanup(curl);
+            std::vector<std::string> changed;
+            g_state->updateCatalog([&](Catalog &catalog)
+                                   { applyCatalog(catalog, next, changed); });
+            groups = std::move(nextGroups);
 
-            if (res != CURLE_OK)
-                throw std::runtime_error(curl_easy_strerror(res));
+            Logger::Log(LogLevel::INFO, "All groups processed successfully. " + std::to_string(changed.size()) + " paths changed.");
+            notifyChanged(changed);
 
-            processResponse(response);
+            prefetchContent();
             Logger::Log(LogLevel::INFO, "File list fetched successfully.");
             return; // Exit on success
         }
@@ -81,98 +148,171 @@ void APIClient::fetchFileList()
     Logger::Log(LogLevel::ERROR, "Max retries reached. Could not fetch file list.");
 }
 
-void APIClient::processResponse(const std::string &response)
+// Downloads the catalog on a helper thread and parses it here as it
+// arrives, turning each group and file straight into catalog entries.
+// Throws on transfer, HTTP or parse errors.
+void APIClient::streamCatalog(std::map<int, SGFS> &nextGroups, std::map<std::string, std::shared_ptr<VirtualFile>> &next)
 {
-    try
+    auto isFileTypeEnabled = [](const char *extension)
+    {
+        return g_state->enabledFileTypes.find(extension) != g_state->enabledFileTypes.end();
+    };
+    const bool xml = isFileTypeEnabled("xml");
+    const bool m3u = isFileTypeEnabled("m3u");
+    const bool strm = isFileTypeEnabled("strm");
+    const bool ts = isFileTypeEnabled("ts");
+
+    auto onGroup = [&](int groupId, const SGFS &group)
+    {
+        std::string groupDir = "/" + group.name;
+        next[groupDir] = nullptr; // Directory
+
+        // Add .xml and .m3u files
+        if (xml)
+            next[groupDir + "/" + group.name + ".xml"] = std::make_shared<VirtualFile>(group.url + ".xml");
+        if (m3u)
+            next[groupDir + "/" + group.name + ".m3u"] = std::make_shared<VirtualFile>(group.url + ".m3u");
+
+        nextGroups[groupId] = group;
+    };
+
+    auto onFile = [&](const SGFS &group, const SMFile &smFile)
     {
-        // Debug log the received JSON response
-        Logger::Log(LogLevel::DEBUG, "Received JSON response: " + response);
+        std::string subDirPath = "/" + group.name + "/" + smFile.name;
+        next.try_emplace(subDirPath, nullptr); // Subgroup directory
 
-        auto jsonResponse = json::parse(response);
-        groups.clear();
+        if (strm)
+            next[subDirPath + "/" + smFile.name + ".strm"] = std::make_shared<VirtualFile>(smFile.url);
+        if (ts)
+            next[subDirPath + "/" + smFile.name + ".ts"] = std::make_shared<VirtualFile>(smFile.url);
+    };
 
-        std::lock_guard<std::mutex> lock(g_state->filesMutex);
-        g_state->files.clear();
+    Pipe pipe(CatalogPipeSize);
+    std::atomic<bool> eof{false};
+    std::atomic<bool> abort{false};
+    CatalogTransfer transfer{pipe, abort};
 
-        auto isFileTypeEnabled = [](const std::string &fileName)
+    CURLcode res = CURLE_OK;
+    long status = 0;
+    std::thread downloader([&]
+                           {
+        CURL *curl = curl_easy_init();
+        if (curl)
         {
-            size_t dotPos = fileName.find_last_of('.');
-            if (dotPos == std::string::npos)
-                return false;                                    // No extension, not enabled
-            std::string extension = fileName.substr(dotPos + 1); // Extract extension
-            return g_state->enabledFileTypes.find(extension) != g_state->enabledFileTypes.end();
-        };
-
-        for (auto &entry : jsonResponse.items())
+            curl_easy_setopt(curl, CURLOPT_URL, baseUrl.c_str());
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_response);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer);
+            curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+            curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+            res = curl_easy_perform(curl);
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+            curl_easy_cleanup(curl);
+        }
+        else
         {
-            int groupId = std::stoi(entry.key());
-            const auto &groupJson = entry.value();
+            res = CURLE_FAILED_INIT;
+        }
+        eof = true;
+        pipe.wakeAll(); });
 
-            SGFS group;
-            group.name = groupJson.value("name", "");
-            group.url = groupJson.value("url", "");
+    CatalogParser parser(onGroup, onFile);
+    PipeStreamBuf streamBuf(pipe, eof);
+    std::istream in(&streamBuf);
 
-            std::string groupDir = "/" + group.name;
-            g_state->files[groupDir] = nullptr; // Directory
-            Logger::Log(LogLevel::DEBUG, "Created group directory: " + groupDir);
+    bool parsed = false;
+    std::string parseError;
+    try
+    {
+        parsed = json::sax_parse(in, &parser);
+        parseError = parser.error();
+    }
+    catch (const std::exception &e)
+    {
+        parseError = e.what();
+    }
 
-            // Add .xml and .m3u files
-            std::string xmlPath = groupDir + "/" + group.name + ".xml";
-            if (isFileTypeEnabled(xmlPath))
-            {
-                g_state->files[xmlPath] = std::make_shared<VirtualFile>(group.url + ".xml");
-                Logger::Log(LogLevel::DEBUG, "Added .xml file: " + xmlPath);
-            }
+    // Unblocks the downloader if parsing stopped early
+    abort = true;
+    pipe.wakeAll();
+    downloader.join();
 
-            std::string m3uPath = groupDir + "/" + group.name + ".m3u";
-            if (isFileTypeEnabled(m3uPath))
-            {
-                g_state->files[m3uPath] = std::make_shared<VirtualFile>(group.url + ".m3u");
-                Logger::Log(LogLevel::DEBUG, "Added .m3u file: " + m3uPath);
-            }
-            // Process sub-files in the group
-            if (groupJson.contains("smfs") && groupJson["smfs"].is_array())
-            {
-                for (const auto &fileJson : groupJson["smfs"])
-                {
-                    SMFile smFile;
-                    smFile.name = fileJson.value("name", "");
-                    smFile.url = fileJson.value("url", "");
-
-                    group.addSMFile(smFile);
-
-                    std::string subDirPath = groupDir + "/" + smFile.name;
-                    if (g_state->files.find(subDirPath) == g_state->files.end())
-                    {
-                        g_state->files[subDirPath] = nullptr; // Create subgroup directory
-                        Logger::Log(LogLevel::DEBUG, "Added subgroup directory: " + subDirPath);
-                    }
-
-                    // Add .strm file
-                    std::string strmPath = subDirPath + "/" + smFile.name + ".strm";
-                    if (isFileTypeEnabled(strmPath))
-                    {
-                        g_state->files[strmPath] = std::make_shared<VirtualFile>(smFile.url);
-                        Logger::Log(LogLevel::DEBUG, "Added .strm file: " + strmPath);
-                    }
-
-                    // Add .ts file
-                    std::string tsPath = subDirPath + "/" + smFile.name + ".ts";
-                    if (isFileTypeEnabled(tsPath))
-                    {
-                        g_state->files[tsPath] = std::make_shared<VirtualFile>(smFile.url);
-                        Logger::Log(LogLevel::DEBUG, "Added .ts file: " + tsPath);
-                    }
-                }
-            }
+    // A parse failure aborts the transfer, which then reports a write error
+    if (!parsed && res == CURLE_WRITE_ERROR)
+        throw std::runtime_error("JSON parse error: " + parseError);
+    if (res != CURLE_OK)
+        throw std::runtime_error(std::string(curl_easy_strerror(res)) + (status ? " (HTTP " + std::to_string(status) + ")" : ""));
+    if (!parsed)
+        throw std::runtime_error("JSON parse error: " + parseError);
 
-            groups[groupId] = group;
+    Logger::Log(LogLevel::DEBUG, "APIClient::streamCatalog: Parsed " + std::to_string(transfer.bytes) + " bytes into " +
+                                     std::to_string(nextGroups.size()) + " groups and " + std::to_string(next.size()) + " paths.");
+}
+
+// Warms the content cache for every group's playlist and guide at once, so
+// consumers arriving together after a (re)load find them ready.
+void APIClient::prefetchContent() const
+{
+    bool xml = g_state->enabledFileTypes.count("xml") > 0;
+    bool m3u = g_state->enabledFileTypes.count("m3u") > 0;
+
+    for (const auto &[groupId, group] : groups)
+    {
+        if (xml)
+            g_state->contentCache.prefetch(group.url + ".xml");
+        if (m3u)
+            g_state->contentCache.prefetch(group.url + ".m3u");
+    }
+    Logger::Log(LogLevel::DEBUG, "APIClient::prefetchContent: Prefetching content for " + std::to_string(groups.size()) + " groups.");
+}
+
+// Merges next into catalog, an unpublished copy. One pass over each finds
+// every add, remove and URL change; only those are applied, so only the
+// catalog shards they fall in are copied. Files the user created under
+// cacheDir are left alone.
+void APIClient::applyCatalog(Catalog &catalog, std::map<std::string, std::shared_ptr<VirtualFile>> &next, std::vector<std::string> &changed)
+{
+    // Collected first: the catalog cannot change under the walk
+    std::vector<std::string> removed;
+    std::vector<std::pair<std::string, std::shared_ptr<VirtualFile>>> updated;
+
+    catalog.forEachFile([&](const std::string &path, const std::shared_ptr<VirtualFile> &file)
+                        {
+                            if ((!file || !file->isUserFile) && !next.contains(path))
+                            {
+                                Logger::Log(LogLevel::DEBUG, "APIClient::applyCatalog: Removed " + path);
+                                removed.push_back(path);
+                            } });
+
+    for (auto &[path, incoming] : next)
+    {
+        bool known = false;
+        auto current = catalog.find(path, known);
+        if (!known)
+        {
+            Logger::Log(LogLevel::DEBUG, "APIClient::applyCatalog: Added " + path);
+            updated.emplace_back(path, std::move(incoming));
+            continue;
         }
 
-        Logger::Log(LogLevel::INFO, "All groups processed successfully.");
+        bool same = current && incoming ? !current->isUserFile && current->url == incoming->url
+                                        : !current && !incoming;
+        if (!same)
+        {
+            // Open handles keep the old file and its stream until released
+            Logger::Log(LogLevel::DEBUG, "APIClient::applyCatalog: Replaced " + path);
+            updated.emplace_back(path, std::move(incoming));
+        }
+    }
+
+    for (const auto &path : removed)
+    {
+        catalog.erase(path);
+        changed.push_back(path);
     }
-    catch (const std::exception &ex)
+    for (auto &[path, file] : updated)
     {
-        Logger::Log(LogLevel::ERROR, "JSON parse error: " + std::string(ex.what()));
+        catalog.set(path, std::move(file));
+        changed.push_back(std::move(path));
     }
 }
@@ -1,26 +1,48 @@
 // File: async_curl_client.cpp
 #include "async_curl_client.hpp"
 #include "logger.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <cctype>
 
 AsyncCurlClient::AsyncCurlClient()
 {
-    curl_global_init(CURL_GLOBAL_ALL);
     multiHandle_ = curl_multi_init();
+    if (!multiHandle_)
+    {
+        throw std::runtime_error("Failed to initialize CURL multi handle");
+    }
     workerThread_ = std::thread(&AsyncCurlClient::eventLoop, this);
 }
 
 AsyncCurlClient::~AsyncCurlClient()
 {
     isRunning_ = false;
+    curl_multi_wakeup(multiHandle_);
     if (workerThread_.joinable())
     {
         workerThread_.join();
     }
+
+    FetchResult aborted;
+    aborted.error = "client shut down";
+
+    addPending();
+    for (auto &[easy, transfer] : transfers_)
+    {
+        curl_multi_remove_handle(multiHandle_, easy);
+        cleanup(*transfer);
+        if (transfer->onComplete)
+        {
+            transfer->onComplete(aborted);
+        }
+    }
+    transfers_.clear();
+
     curl_multi_cleanup(multiHandle_);
-    curl_global_cleanup();
 }
 
-void AsyncCurlClient::fetchStreamAsync(const std::string &url, std::function<void(const std::string &data)> onDataReceived)
+std::unique_ptr<AsyncCurlClient::Transfer> AsyncCurlClient::createTransfer(const std::string &url, CompleteCallback onComplete)
 {
     CURL *easyHandle = curl_easy_init();
     if (!easyHandle)
@@ -28,66 +50,203 @@ void AsyncCurlClient::fetchStreamAsync(const std::string &url, std::function<voi
         throw std::runtime_error("Failed to initialize CURL easy handle");
     }
 
-    std::string *responseData = new std::string();
-    curl_easy_setopt(easyHandle, CURLOPT_URL, url.c_str());
+    auto transfer = std::make_unique<Transfer>();
+    transfer->easy = easyHandle;
+    transfer->url = url;
+    transfer->onComplete = std::move(onComplete);
+
+    curl_easy_setopt(easyHandle, CURLOPT_URL, transfer->url.c_str());
     curl_easy_setopt(easyHandle, CURLOPT_WRITEFUNCTION, writeCallback);
-    curl_easy_setopt(easyHandle, CURLOPT_WRITEDATA, responseData);
+    curl_easy_setopt(easyHandle, CURLOPT_WRITEDATA, transfer.get());
+    curl_easy_setopt(easyHandle, CURLOPT_HEADERFUNCTION, headerCallback);
+    curl_easy_setopt(easyHandle, CURLOPT_HEADERDATA, transfer.get());
+    curl_easy_setopt(easyHandle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(easyHandle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(easyHandle, CURLOPT_CONNECTTIMEOUT, ConnectTimeoutSeconds);
+    curl_easy_setopt(easyHandle, CURLOPT_LOW_SPEED_LIMIT, LowSpeedLimitBytes);
+    curl_easy_setopt(easyHandle, CURLOPT_LOW_SPEED_TIME, LowSpeedTimeSeconds);
+    return transfer;
+}
 
+void AsyncCurlClient::queue(std::unique_ptr<Transfer> transfer)
+{
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        callbacks_[easyHandle] = [onDataReceived, responseData]()
-        {
-            onDataReceived(*responseData);
-            delete responseData;
-        };
+        pending_.push_back(std::move(transfer));
+    }
+
+    // The multi handle belongs to the worker; it adds the handle once woken.
+    curl_multi_wakeup(multiHandle_);
+}
+
+void AsyncCurlClient::fetchStreamAsync(const std::string &url, ChunkCallback onChunk, CompleteCallback onComplete,
+                                       const std::vector<std::string> &headers)
+{
+    auto transfer = createTransfer(url, std::move(onComplete));
+    transfer->onChunk = std::move(onChunk);
+
+    for (const auto &header : headers)
+    {
+        transfer->headers = curl_slist_append(transfer->headers, header.c_str());
+    }
+    if (transfer->headers)
+    {
+        curl_easy_setopt(transfer->easy, CURLOPT_HTTPHEADER, transfer->headers);
     }
 
-    curl_multi_add_handle(multiHandle_, easyHandle);
+    queue(std::move(transfer));
+}
+
+void AsyncCurlClient::headAsync(const std::string &url, CompleteCallback onComplete)
+{
+    auto transfer = createTransfer(url, std::move(onComplete));
+    curl_easy_setopt(transfer->easy, CURLOPT_NOBODY, 1L);
+    queue(std::move(transfer));
 }
 
 size_t AsyncCurlClient::writeCallback(void *contents, size_t size, size_t nmemb, void *userp)
 {
-    auto *data = static_cast<std::string *>(userp);
-    data->append(static_cast<char *>(contents), size * nmemb);
-    return size * nmemb;
+    auto *transfer = static_cast<Transfer *>(userp);
+    size_t total = size * nmemb;
+
+    // Error pages are never handed to callers as content.
+    long status = 0;
+    curl_easy_getinfo(transfer->easy, CURLINFO_RESPONSE_CODE, &status);
+    if (status >= 400)
+    {
+        return total;
+    }
+
+    if (transfer->onChunk && !transfer->onChunk(std::string_view(static_cast<char *>(contents), total)))
+    {
+        return 0; // Caller aborted the transfer
+    }
+    return total;
+}
+
+// Captures the validators needed for conditional revalidation.
+size_t AsyncCurlClient::headerCallback(char *buffer, size_t size, size_t nitems, void *userp)
+{
+    auto *transfer = static_cast<Transfer *>(userp);
+    size_t total = size * nitems;
+    std::string_view line(buffer, total);
+
+    if (line.starts_with("HTTP/"))
+    {
+        // Status line of a new response (e.g. after a redirect): reset.
+        transfer->etag.clear();
+        transfer->lastModified.clear();
+        return total;
+    }
+
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos)
+        return total;
+
+    std::string name(line.substr(0, colon));
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+    std::string_view value = line.substr(colon + 1);
+    while (!value.empty() && std::isspace(static_cast<unsigned char>(value.front())))
+        value.remove_prefix(1);
+    while (!value.empty() && std::isspace(static_cast<unsigned char>(value.back())))
+        value.remove_suffix(1);
+
+    if (name == "etag")
+        transfer->etag = value;
+    else if (name == "last-modified")
+        transfer->lastModified = value;
+
+    return total;
+}
+
+void AsyncCurlClient::cleanup(Transfer &transfer)
+{
+    curl_easy_cleanup(transfer.easy);
+    transfer.easy = nullptr;
+    curl_slist_free_all(transfer.headers);
+    transfer.headers = nullptr;
+}
+
+void AsyncCurlClient::addPending()
+{
+    std::vector<std::unique_ptr<Transfer>> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending.swap(pending_);
+    }
+
+    for (auto &transfer : pending)
+    {
+        CURL *easy = transfer->easy;
+        curl_multi_add_handle(multiHandle_, easy);
+        transfers_[easy] = std::move(transfer);
+    }
+}
+
+void AsyncCurlClient::completeTransfers()
+{
+    int numMessages;
+    CURLMsg *msg;
+    while ((msg = curl_multi_info_read(multiHandle_, &numMessages)))
+    {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+
+        CURL *easyHandle = msg->easy_handle;
+        auto it = transfers_.find(easyHandle);
+        if (it == transfers_.end())
+            continue;
+
+        auto transfer = std::move(it->second);
+        transfers_.erase(it);
+
+        FetchResult result;
+        curl_easy_getinfo(easyHandle, CURLINFO_RESPONSE_CODE, &result.status);
+        curl_off_t contentLength = -1;
+        curl_easy_getinfo(easyHandle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &contentLength);
+        result.contentLength = contentLength;
+        result.etag = std::move(transfer->etag);
+        result.lastModified = std::move(transfer->lastModified);
+        if (msg->data.result != CURLE_OK)
+        {
+            result.error = curl_easy_strerror(msg->data.result);
+        }
+        else if (result.status >= 400)
+        {
+            result.error = "HTTP " + std::to_string(result.status);
+        }
+        else
+        {
+            result.ok = true;
+        }
+
+        if (!result.ok)
+        {
+            Logger::Log(LogLevel::WARN, "AsyncCurlClient: Fetch of " + transfer->url + " failed: " + result.error);
+        }
+
+        curl_multi_remove_handle(multiHandle_, easyHandle);
+        cleanup(*transfer);
+
+        if (transfer->onComplete)
+        {
+            transfer->onComplete(result);
+        }
+    }
 }
 
 void AsyncCurlClient::eventLoop()
 {
     while (isRunning_)
     {
+        addPending();
+
         int runningHandles;
         curl_multi_perform(multiHandle_, &runningHandles);
+        completeTransfers();
 
-        int numMessages;
-        CURLMsg *msg;
-        while ((msg = curl_multi_info_read(multiHandle_, &numMessages)))
-        {
-            if (msg->msg == CURLMSG_DONE)
-            {
-                CURL *easyHandle = msg->easy_handle;
-
-                std::function<void()> callback;
-                {
-                    std::lock_guard<std::mutex> lock(mutex_);
-                    auto it = callbacks_.find(easyHandle);
-                    if (it != callbacks_.end())
-                    {
-                        callback = std::move(it->second);
-                        callbacks_.erase(it);
-                    }
-                }
-
-                if (callback)
-                {
-                    callback();
-                }
-
-                curl_multi_remove_handle(multiHandle_, easyHandle);
-                curl_easy_cleanup(easyHandle);
-            }
-        }
-
-        std::this_thread::sleep_for(std::chrono::milliseconds(50)); // Polling interval
+        // Sleeps until socket activity, a curl timeout, or curl_multi_wakeup.
+        curl_multi_poll(multiHandle_, nullptr, 0, 1000, nullptr);
     }
 }
@@ -0,0 +1,150 @@
+// File: catalog.cpp
+#include "catalog.hpp"
+#include "fuse_operations.hpp"
+#include "smfs_state.hpp"
+#include <algorithm>
+
+void Catalog::split(const std::string &path, std::string &parent, std::string &name)
+{
+    size_t slash = path.rfind('/');
+    parent = slash == 0 ? "/" : path.substr(0, slash);
+    name = path.substr(slash + 1);
+}
+
+// Adds path to, or removes it from, the paths served from file's URL
+void Catalog::indexContent(const std::string &path, const std::shared_ptr<VirtualFile> &file, bool add)
+{
+    if (!file || file->isUserFile || !(path.ends_with(".xml") || path.ends_with(".m3u")))
+    {
+        return;
+    }
+
+    auto &shard = contentPaths_.edit(hashPath(file->url));
+    auto &paths = shard[file->url];
+    if (add)
+    {
+        paths.push_back(path);
+        return;
+    }
+
+    std::erase(paths, path);
+    if (paths.empty())
+    {
+        shard.erase(file->url);
+    }
+}
+
+std::shared_ptr<VirtualFile> Catalog::find(const std::string &path, bool &found) const
+{
+    const auto &shard = files_.at(hashPath(path));
+    auto it = shard.find(path);
+    found = it != shard.end();
+    return found ? it->second : nullptr;
+}
+
+void Catalog::set(const std::string &path, std::shared_ptr<VirtualFile> file)
+{
+    std::string parentPath, name;
+    split(path, parentPath, name);
+    fuse_ino_t parent = getInode(parentPath);
+
+    // Entries and directories holding entries keep their inodes pinned, so
+    // the kernel forgetting them never changes the keys used here
+    auto &dirs = dirs_.edit(hashIno(parent));
+    auto [dirIt, newDir] = dirs.try_emplace(parent);
+    if (newDir)
+    {
+        inodeTable.pin(parent);
+    }
+
+    auto &children = dirIt->second;
+    auto [it, inserted] = children.try_emplace(name, Node{getInode(path), file});
+    if (inserted)
+    {
+        inodeTable.pin(it->second.ino);
+    }
+    else
+    {
+        it->second.file = file;
+    }
+
+    Key key{parent, name};
+    nodes_.edit(KeyHash()(key)).insert_or_assign(std::move(key), it->second);
+
+    auto &files = files_.edit(hashPath(path));
+    auto [fileIt, added] = files.try_emplace(path, file);
+    if (!added)
+    {
+        indexContent(path, fileIt->second, false);
+        fileIt->second = file;
+    }
+    indexContent(path, file, true);
+}
+
+void Catalog::erase(const std::string &path)
+{
+    if (!files_.at(hashPath(path)).contains(path))
+    {
+        return;
+    }
+    auto &files = files_.edit(hashPath(path));
+    auto fileIt = files.find(path);
+    indexContent(path, fileIt->second, false);
+    files.erase(fileIt);
+
+    std::string parentPath, name;
+    split(path, parentPath, name);
+    auto parent = inodeTable.find(parentPath);
+    if (!parent)
+    {
+        return;
+    }
+
+    if (!dirs_.at(hashIno(*parent)).contains(*parent))
+    {
+        return;
+    }
+    auto &dirs = dirs_.edit(hashIno(*parent));
+    auto dirIt = dirs.find(*parent);
+
+    auto it = dirIt->second.find(name);
+    if (it != dirIt->second.end())
+    {
+        fuse_ino_t ino = it->second.ino;
+        KeyView key{*parent, name};
+        auto &nodes = nodes_.edit(KeyHash()(key));
+        if (auto node = nodes.find(key); node != nodes.end())
+        {
+            nodes.erase(node);
+        }
+        dirIt->second.erase(it);
+        inodeTable.unpin(ino);
+    }
+    if (dirIt->second.empty())
+    {
+        dirs.erase(dirIt);
+        inodeTable.unpin(*parent);
+    }
+}
+
+const Catalog::Node *Catalog::lookup(fuse_ino_t parent, std::string_view name) const
+{
+    KeyView key{parent, name};
+    const auto &nodes = nodes_.at(KeyHash()(key));
+    auto it = nodes.find(key);
+    return it == nodes.end() ? nullptr : &it->second;
+}
+
+const Catalog::Children *Catalog::children(fuse_ino_t dir) const
+{
+    const auto &dirs = dirs_.at(hashIno(dir));
+    auto it = dirs.find(dir);
+    return it == dirs.end() ? nullptr : &it->second;
+}
+
+const std::vector<std::string> *Catalog::contentPaths(const std::string &url) const
+{
+    const auto &urls = contentPaths_.at(hashPath(url));
+    auto it = urls.find(url);
+    return it == urls.end() ? nullptr : &it->second;
+}
@@ -0,0 +1,185 @@
+// File: catalog_parser.cpp
+#include "catalog_parser.hpp"
+
+CatalogParser::CatalogParser(GroupCallback onGroup, FileCallback onFile)
+    : onGroup_(std::move(onGroup)), onFile_(std::move(onFile)) {}
+
+// Any non-string value ends the current key without being used.
+void CatalogParser::scalar()
+{
+    field_ = Field::None;
+}
+
+bool CatalogParser::null()
+{
+    scalar();
+    return true;
+}
+
+bool CatalogParser::boolean(bool)
+{
+    scalar();
+    return true;
+}
+
+bool CatalogParser::number_integer(number_integer_t)
+{
+    scalar();
+    return true;
+}
+
+bool CatalogParser::number_unsigned(number_unsigned_t)
+{
+    scalar();
+    return true;
+}
+
+bool CatalogParser::number_float(number_float_t, const string_t &)
+{
+    scalar();
+    return true;
+}
+
+bool CatalogParser::binary(binary_t &)
+{
+    scalar();
+    return true;
+}
+
+bool CatalogParser::string(string_t &val)
+{
+    if (depth_ == GroupDepth && !inFiles_)
+    {
+        if (field_ == Field::Name)
+            group_.name = std::move(val);
+        else if (field_ == Field::Url)
+            group_.url = std::move(val);
+    }
+    else if (depth_ == FileDepth && inFiles_)
+    {
+        if (field_ == Field::Name)
+            file_.name = std::move(val);
+        else if (field_ == Field::Url)
+            file_.url = std::move(val);
+    }
+    field_ = Field::None;
+    return true;
+}
+
+bool CatalogParser::key(string_t &val)
+{
+    field_ = Field::None;
+    if (depth_ == 1)
+    {
+        groupKey_ = std::move(val);
+    }
+    else if ((depth_ == GroupDepth && !inFiles_) || (depth_ == FileDepth && inFiles_))
+    {
+        if (val == "name")
+            field_ = Field::Name;
+        else if (val == "url")
+            field_ = Field::Url;
+        else if (val == "smfs" && depth_ == GroupDepth)
+            field_ = Field::Files;
+    }
+    return true;
+}
+
+bool CatalogParser::start_object(std::size_t)
+{
+    depth_++;
+    if (depth_ == GroupDepth)
+    {
+        startGroup();
+    }
+    else if (depth_ == FileDepth && inFiles_)
+    {
+        file_ = SMFile();
+    }
+    field_ = Field::None;
+    return true;
+}
+
+bool CatalogParser::end_object()
+{
+    if (depth_ == GroupDepth)
+    {
+        finishGroup();
+    }
+    else if (depth_ == FileDepth && inFiles_)
+    {
+        emitFile();
+    }
+    depth_--;
+    field_ = Field::None;
+    return true;
+}
+
+bool CatalogParser::start_array(std::size_t)
+{
+    depth_++;
+    if (depth_ == FilesDepth && field_ == Field::Files)
+    {
+        inFiles_ = true;
+
+        // Usually name and url come first and files can go out directly
+        if (!group_.name.empty() && !group_.url.empty() && !groupEmitted_)
+        {
+            onGroup_(groupId_, group_);
+            groupEmitted_ = true;
+        }
+    }
+    field_ = Field::None;
+    return true;
+}
+
+bool CatalogParser::end_array()
+{
+    if (depth_ == FilesDepth && inFiles_)
+    {
+        inFiles_ = false;
+    }
+    depth_--;
+    field_ = Field::None;
+    return true;
+}
+
+bool CatalogParser::parse_error(std::size_t position, const std::string &lastToken, const nlohmann::detail::exception &ex)
+{
+    error_ = std::string(ex.what()) + " at byte " + std::to_string(position) + " near '" + lastToken + "'";
+    return false;
+}
+
+void CatalogParser::startGroup()
+{
+    groupId_ = std::stoi(groupKey_);
+    group_ = SGFS();
+    groupEmitted_ = false;
+    pending_.clear();
+}
+
+void CatalogParser::finishGroup()
+{
+    if (!groupEmitted_)
+    {
+        onGroup_(groupId_, group_);
+        groupEmitted_ = true;
+    }
+    for (const auto &file : pending_)
+    {
+        onFile_(group_, file);
+    }
+    pending_.clear();
+}
+
+void CatalogParser::emitFile()
+{
+    if (groupEmitted_)
+    {
+        onFile_(group_, file_);
+    }
+    else
+    {
+        pending_.push_back(std::move(file_));
+    }
+}
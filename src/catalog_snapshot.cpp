@@ -0,0 +1,225 @@
+// File: catalog_snapshot.cpp
+#include "catalog_snapshot.hpp"
+#include "smfs_state.hpp"
+#include "logger.hpp"
+#include "fuse_operations.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+    constexpr char Magic[8] = {'S', 'M', 'F', 'S', 'C', 'A', 'T', '\0'};
+    constexpr uint32_t Version = 2;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t entryCount;
+        uint32_t groupCount;
+        uint32_t reserved;
+        uint64_t stringsSize;
+        uint64_t checksum; // FNV-1a of everything after the header
+    };
+
+    struct StringRef
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct Entry
+    {
+        StringRef path;
+        StringRef url;
+        uint32_t isFile;
+        uint32_t reserved;
+        uint64_t ino; // 0 if the path had no inode when saved
+    };
+
+    struct Group
+    {
+        int32_t id;
+        StringRef name;
+        StringRef url;
+    };
+
+    static_assert(sizeof(Header) == 40 && sizeof(Entry) == 32 && sizeof(Group) == 20, "snapshot layout changed");
+
+    uint64_t fnv1a(const char *data, size_t size, uint64_t hash = 14695981039346656037ull)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    StringRef addString(std::string &strings, const std::string &value)
+    {
+        StringRef ref{static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(value.size())};
+        strings += value;
+        return ref;
+    }
+}
+
+bool CatalogSnapshot::save(const std::string &path, const Files &files, const Groups &groups)
+{
+    std::vector<Entry> entries;
+    std::vector<Group> groupRecords;
+    std::string strings;
+    entries.reserve(files.size());
+    groupRecords.reserve(groups.size());
+
+    for (const auto &[filePath, vf] : files)
+    {
+        if (vf && vf->isUserFile)
+            continue;
+        entries.push_back({addString(strings, filePath), vf ? addString(strings, vf->url) : StringRef{0, 0}, vf ? 1u : 0u, 0,
+                           inodeTable.find(filePath).value_or(0)});
+    }
+    for (const auto &[id, group] : groups)
+    {
+        groupRecords.push_back({id, addString(strings, group.name), addString(strings, group.url)});
+    }
+
+    Header header = {};
+    std::memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = Version;
+    header.entryCount = static_cast<uint32_t>(entries.size());
+    header.groupCount = static_cast<uint32_t>(groupRecords.size());
+    header.stringsSize = strings.size();
+
+    uint64_t checksum = fnv1a(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(Entry));
+    checksum = fnv1a(reinterpret_cast<const char *>(groupRecords.data()), groupRecords.size() * sizeof(Group), checksum);
+    header.checksum = fnv1a(strings.data(), strings.size(), checksum);
+
+    std::string tmpPath = path + ".tmp";
+    FILE *out = fopen(tmpPath.c_str(), "wb");
+    if (!out)
+    {
+        Logger::Log(LogLevel::WARN, "CatalogSnapshot::save: Cannot create " + tmpPath + ": " + strerror(errno));
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(entries.data(), sizeof(Entry), entries.size(), out) == entries.size() &&
+              fwrite(groupRecords.data(), sizeof(Group), groupRecords.size(), out) == groupRecords.size() &&
+              fwrite(strings.data(), 1, strings.size(), out) == strings.size();
+    ok = fclose(out) == 0 && ok;
+
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        Logger::Log(LogLevel::WARN, "CatalogSnapshot::save: Failed to write " + path + ": " + strerror(errno));
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    Logger::Log(LogLevel::DEBUG, "CatalogSnapshot::save: Saved " + std::to_string(entries.size()) + " entries to " + path);
+    return true;
+}
+
+bool CatalogSnapshot::load(const std::string &path, Files &files, Groups &groups, Inodes &inodes)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        Logger::Log(LogLevel::INFO, "CatalogSnapshot::load: No snapshot at " + path);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header))
+    {
+        close(fd);
+        Logger::Log(LogLevel::WARN, "CatalogSnapshot::load: Snapshot too small: " + path);
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        Logger::Log(LogLevel::WARN, "CatalogSnapshot::load: Cannot map " + path + ": " + strerror(errno));
+        return false;
+    }
+
+    const char *base = static_cast<const char *>(addr);
+    Header header;
+    std::memcpy(&header, base, sizeof(header));
+
+    size_t entriesSize = size_t{header.entryCount} * sizeof(Entry);
+    size_t groupsSize = size_t{header.groupCount} * sizeof(Group);
+    bool valid = std::memcmp(header.magic, Magic, sizeof(Magic)) == 0 && header.version == Version &&
+                 sizeof(Header) + entriesSize + groupsSize + header.stringsSize == size &&
+                 fnv1a(base + sizeof(Header), size - sizeof(Header)) == header.checksum;
+    if (!valid)
+    {
+        munmap(addr, size);
+        Logger::Log(LogLevel::WARN, "CatalogSnapshot::load: Ignoring invalid or incompatible snapshot: " + path);
+        return false;
+    }
+
+    // Entries are 8-byte aligned after the 40-byte header, groups 4-byte
+    // aligned after them
+    const auto *entries = reinterpret_cast<const Entry *>(base + sizeof(Header));
+    const auto *groupRecords = reinterpret_cast<const Group *>(base + sizeof(Header) + entriesSize);
+    const char *strings = base + sizeof(Header) + entriesSize + groupsSize;
+
+    auto text = [&](StringRef ref)
+    {
+        if (uint64_t{ref.offset} + ref.length > header.stringsSize)
+            return std::string();
+        return std::string(strings + ref.offset, ref.length);
+    };
+
+    Files loadedFiles;
+    Inodes loadedInodes;
+    for (uint32_t i = 0; i < header.entryCount; i++)
+    {
+        std::string filePath = text(entries[i].path);
+        if (filePath.empty())
+            continue;
+
+        if (!entries[i].isFile)
+        {
+            loadedFiles[filePath] = nullptr;
+            if (entries[i].ino)
+                loadedInodes[filePath] = entries[i].ino;
+            continue;
+        }
+
+        // Honour the current enabledFileTypes, not the ones it was saved with
+        size_t dot = filePath.find_last_of('.');
+        if (dot == std::string::npos || !g_state->enabledFileTypes.contains(filePath.substr(dot + 1)))
+            continue;
+
+        loadedFiles[filePath] = std::make_shared<VirtualFile>(text(entries[i].url));
+        if (entries[i].ino)
+            loadedInodes[filePath] = entries[i].ino;
+    }
+
+    Groups loadedGroups;
+    for (uint32_t i = 0; i < header.groupCount; i++)
+    {
+        loadedGroups[groupRecords[i].id] = SGFS(text(groupRecords[i].name), text(groupRecords[i].url));
+    }
+
+    munmap(addr, size);
+
+    files = std::move(loadedFiles);
+    groups = std::move(loadedGroups);
+    inodes = std::move(loadedInodes);
+    Logger::Log(LogLevel::INFO, "CatalogSnapshot::load: Loaded " + std::to_string(files.size()) + " entries and " +
+                                    std::to_string(groups.size()) + " groups from " + path);
+    return true;
+}
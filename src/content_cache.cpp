@@ -0,0 +1,573 @@
+// File: content_cache.cpp
+#include "content_cache.hpp"
+#include "logger.hpp"
+#include <nlohmann/json.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <map>
+
+using json = nlohmann::json;
+
+// On-disk copies of cached documents. Each downloaded version gets its own
+// file, named after the URL hash plus a version number, so a new version
+// never overwrites a file that is still mapped. index.json maps URLs to
+// their current file and validators.
+struct ContentCache::DiskStore
+{
+    struct Record
+    {
+        std::string file;
+        std::string etag;
+        std::string lastModified;
+        size_t size = 0;
+    };
+
+    // One version being written to <file>.tmp while it downloads
+    struct Spool
+    {
+        int fd = -1;
+        std::string file;
+        std::string tmpPath;
+        bool committed = false;
+
+        ~Spool()
+        {
+            if (fd >= 0)
+                close(fd);
+            if (!committed)
+                unlink(tmpPath.c_str());
+        }
+
+        void write(std::string_view data)
+        {
+            while (fd >= 0 && !data.empty())
+            {
+                ssize_t n = ::write(fd, data.data(), data.size());
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                {
+                    // Keep serving from memory; this version just is not persisted
+                    Logger::Log(LogLevel::WARN, "ContentCache: Failed to write " + tmpPath + ": " + strerror(errno));
+                    close(fd);
+                    fd = -1;
+                    return;
+                }
+                data.remove_prefix(static_cast<size_t>(n));
+            }
+        }
+    };
+
+    std::string dir;
+    std::mutex mutex;
+    std::map<std::string, Record> records;
+    uint64_t nextVersion = 1;
+
+    std::string path(const std::string &file) const
+    {
+        return dir + "/" + file;
+    }
+
+    static std::string hashName(const std::string &url)
+    {
+        // FNV-1a; collisions only share a prefix, versions keep names unique
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : url)
+        {
+            hash = (hash ^ c) * 1099511628211ull;
+        }
+        char name[17];
+        snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+        return name;
+    }
+
+    std::shared_ptr<Spool> begin(const std::string &url)
+    {
+        auto spool = std::make_shared<Spool>();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            spool->file = hashName(url) + "." + std::to_string(nextVersion++);
+        }
+        spool->tmpPath = path(spool->file) + ".tmp";
+        spool->fd = ::open(spool->tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (spool->fd < 0)
+        {
+            Logger::Log(LogLevel::WARN, "ContentCache: Cannot create " + spool->tmpPath + ": " + strerror(errno));
+        }
+        return spool;
+    }
+
+    // Moves a finished spool into place and records it as url's current
+    // version. Returns the mapped copy, or nullptr if it was not persisted.
+    std::shared_ptr<Body> commit(const std::string &url, Spool &spool, const FetchResult &result, size_t size)
+    {
+        if (spool.fd < 0)
+            return nullptr;
+        close(spool.fd);
+        spool.fd = -1;
+
+        if (rename(spool.tmpPath.c_str(), path(spool.file).c_str()) != 0)
+        {
+            Logger::Log(LogLevel::WARN, "ContentCache: Cannot rename " + spool.tmpPath + ": " + strerror(errno));
+            return nullptr;
+        }
+        spool.committed = true;
+
+        auto mapped = Body::mapFile(path(spool.file), size);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &record = records[url];
+        std::string old = record.file;
+        record = {spool.file, result.etag, result.lastModified, size};
+        writeIndex();
+
+        // Mappings of the old version stay valid after the unlink
+        if (!old.empty() && old != spool.file)
+        {
+            unlink(path(old).c_str());
+        }
+        return mapped;
+    }
+
+    // Called with mutex held
+    void writeIndex()
+    {
+        json index = json::object();
+        for (const auto &[url, record] : records)
+        {
+            index[url] = {{"file", record.file},
+                          {"etag", record.etag},
+                          {"lastModified", record.lastModified},
+                          {"size", record.size}};
+        }
+
+        std::string indexPath = path("index.json");
+        std::string tmpPath = indexPath + ".tmp";
+        {
+            std::ofstream out(tmpPath, std::ios::trunc);
+            out << index.dump();
+            if (!out)
+            {
+                Logger::Log(LogLevel::WARN, "ContentCache: Failed to write " + tmpPath);
+                return;
+            }
+        }
+        rename(tmpPath.c_str(), indexPath.c_str());
+    }
+};
+
+void ContentCache::Body::append(std::string_view data)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!data.empty())
+    {
+        size_t used = size_ % BlockSize;
+        if (used == 0 && size_ / BlockSize == blocks_.size())
+        {
+            blocks_.push_back(std::make_unique<char[]>(BlockSize));
+        }
+
+        size_t n = std::min(data.size(), BlockSize - used);
+        std::memcpy(blocks_[size_ / BlockSize].get() + used, data.data(), n);
+        size_ += n;
+        data.remove_prefix(n);
+    }
+    cond_.notify_all();
+}
+
+void ContentCache::Body::finish(bool ok)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    complete_ = ok;
+    failed_ = !ok;
+    cond_.notify_all();
+}
+
+ContentCache::Body::~Body()
+{
+    if (mapped_)
+    {
+        munmap(const_cast<char *>(mapped_), size_);
+    }
+}
+
+std::shared_ptr<ContentCache::Body> ContentCache::Body::mapFile(const std::string &path, size_t size)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != size)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    auto body = std::make_shared<Body>();
+    if (size > 0)
+    {
+        void *addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            close(fd);
+            return nullptr;
+        }
+        madvise(addr, size, MADV_SEQUENTIAL);
+        body->mapped_ = static_cast<const char *>(addr);
+    }
+    close(fd);
+
+    body->size_ = size;
+    body->complete_ = true;
+    return body;
+}
+
+std::optional<size_t> ContentCache::Body::completeSize() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!complete_)
+    {
+        return std::nullopt;
+    }
+    return size_;
+}
+
+ssize_t ContentCache::Body::read(char *buf, size_t size, off_t offset) const
+{
+    size_t start = static_cast<size_t>(offset);
+    size_t end = start + size;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [&]
+               { return size_ >= end || complete_ || failed_; });
+
+    if (start >= size_)
+    {
+        return failed_ ? -EIO : 0;
+    }
+
+    size_t toRead = std::min(end, size_) - start;
+    if (mapped_)
+    {
+        std::memcpy(buf, mapped_ + start, toRead);
+        return static_cast<ssize_t>(toRead);
+    }
+
+    size_t copied = 0;
+    while (copied < toRead)
+    {
+        size_t pos = start + copied;
+        size_t n = std::min(toRead - copied, BlockSize - pos % BlockSize);
+        std::memcpy(buf + copied, blocks_[pos / BlockSize].get() + pos % BlockSize, n);
+        copied += n;
+    }
+    return static_cast<ssize_t>(copied);
+}
+
+ContentCache::ContentCache(IStreamingClient &client)
+    : client_(client) {}
+
+void ContentCache::setTtl(std::chrono::seconds ttl)
+{
+    ttl_ = ttl;
+}
+
+void ContentCache::setChangeCallback(ChangeCallback onChange)
+{
+    onChange_ = std::move(onChange);
+}
+
+void ContentCache::setPersistDir(const std::string &dir)
+{
+    // Create the directory and its parents
+    for (size_t pos = dir.find('/', 1); ; pos = dir.find('/', pos + 1))
+    {
+        std::string subDir = dir.substr(0, pos);
+        if (mkdir(subDir.c_str(), 0755) == -1 && errno != EEXIST)
+        {
+            Logger::Log(LogLevel::ERROR, "ContentCache::setPersistDir: Cannot create " + subDir + ": " + strerror(errno));
+            return;
+        }
+        if (pos == std::string::npos)
+            break;
+    }
+
+    auto store = std::make_shared<DiskStore>();
+    store->dir = dir;
+
+    json index;
+    std::ifstream in(store->path("index.json"));
+    if (in.is_open())
+    {
+        try
+        {
+            in >> index;
+        }
+        catch (const std::exception &e)
+        {
+            Logger::Log(LogLevel::WARN, "ContentCache::setPersistDir: Ignoring unreadable index: " + std::string(e.what()));
+            index = json::object();
+        }
+    }
+
+    size_t loaded = 0;
+    if (index.is_object())
+    {
+        for (const auto &[url, item] : index.items())
+        {
+            DiskStore::Record record;
+            record.file = item.value("file", "");
+            record.etag = item.value("etag", "");
+            record.lastModified = item.value("lastModified", "");
+            record.size = item.value("size", size_t{0});
+
+            auto body = record.file.empty() ? nullptr : Body::mapFile(store->path(record.file), record.size);
+            if (!body)
+            {
+                Logger::Log(LogLevel::WARN, "ContentCache::setPersistDir: Dropping missing or truncated copy of " + url);
+                continue;
+            }
+
+            // Served immediately; the stale timestamp makes the first open revalidate
+            auto entry = getEntry(url);
+            entry->body = body;
+            entry->etag = record.etag;
+            entry->lastModified = record.lastModified;
+
+            uint64_t version = strtoull(record.file.c_str() + record.file.rfind('.') + 1, nullptr, 10);
+            store->nextVersion = std::max<uint64_t>(store->nextVersion, version + 1);
+            store->records[url] = std::move(record);
+            loaded++;
+        }
+    }
+
+    // Remove versions nothing refers to, e.g. downloads cut short by a crash
+    if (DIR *d = opendir(dir.c_str()))
+    {
+        while (struct dirent *ent = readdir(d))
+        {
+            std::string name = ent->d_name;
+            if (name == "." || name == ".." || name == "index.json")
+                continue;
+            bool referenced = std::any_of(store->records.begin(), store->records.end(), [&](const auto &kv)
+                                          { return kv.second.file == name; });
+            if (!referenced)
+            {
+                unlink(store->path(name).c_str());
+            }
+        }
+        closedir(d);
+    }
+
+    store_ = std::move(store);
+    Logger::Log(LogLevel::INFO, "ContentCache: Loaded " + std::to_string(loaded) + " cached documents from " + dir);
+}
+
+void ContentCache::prefetch(const std::string &url)
+{
+    open(url);
+}
+
+std::shared_ptr<ContentCache::Entry> ContentCache::getEntry(const std::string &url)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &entry = entries_[url];
+    if (!entry)
+    {
+        entry = std::make_shared<Entry>();
+    }
+    return entry;
+}
+
+void ContentCache::startFetch(const std::string &url, const std::shared_ptr<Entry> &entry)
+{
+    std::vector<std::string> headers;
+    if (entry->body)
+    {
+        if (!entry->etag.empty())
+            headers.push_back("If-None-Match: " + entry->etag);
+        if (!entry->lastModified.empty())
+            headers.push_back("If-Modified-Since: " + entry->lastModified);
+    }
+
+    Logger::Log(LogLevel::DEBUG, "ContentCache::startFetch: " + std::string(entry->body ? "Revalidating " : "Fetching ") + url);
+
+    // A first download is published right away so readers can follow it as
+    // it grows; a refresh replaces the served copy only once it is complete.
+    auto body = std::make_shared<Body>();
+    bool published = !entry->body;
+    if (published)
+    {
+        entry->body = body;
+    }
+
+    // Written to disk alongside memory; dropped unless the download completes
+    auto store = store_;
+    auto spool = store ? store->begin(url) : nullptr;
+
+    auto onChunk = [body, spool](std::string_view chunk)
+    {
+        body->append(chunk);
+        if (spool)
+        {
+            spool->write(chunk);
+        }
+        return true;
+    };
+
+    auto onComplete = [entry, body, published, url, store, spool, onChange = onChange_](const FetchResult &result)
+    {
+        bool changed = false;
+        {
+            std::lock_guard<std::mutex> lock(entry->mutex);
+            entry->fetching = false;
+            entry->fetchedAt = std::chrono::steady_clock::now();
+
+            if (result.ok && result.status == 304 && !published)
+            {
+                Logger::Log(LogLevel::DEBUG, "ContentCache: Not modified: " + url);
+                return;
+            }
+
+            body->finish(result.ok);
+            if (result.ok)
+            {
+                Logger::Log(LogLevel::INFO, "ContentCache: Cached " + std::to_string(body->size_) + " bytes for " + url);
+
+                // A refresh is a new version. A first download only changes
+                // what the kernel saw if it was given no size yet, or a HEAD
+                // reported a different one.
+                changed = !published || entry->headSize != body->size_;
+                entry->headSize.reset();
+                entry->headAt = {};
+
+                // Once on disk, serve the mapped copy and let the blocks go
+                std::shared_ptr<Body> mapped;
+                if (spool)
+                {
+                    mapped = store->commit(url, *spool, result, body->size_);
+                }
+
+                entry->body = mapped ? mapped : body;
+                entry->etag = result.etag;
+                entry->lastModified = result.lastModified;
+            }
+            else if (published)
+            {
+                // Nothing usable: the next open starts over
+                Logger::Log(LogLevel::ERROR, "ContentCache: Failed to fetch " + url + ": " + result.error);
+                entry->body.reset();
+            }
+            else
+            {
+                Logger::Log(LogLevel::WARN, "ContentCache: Revalidation of " + url + " failed, serving cached copy: " + result.error);
+            }
+        }
+
+        if (changed && onChange)
+        {
+            onChange(url);
+        }
+    };
+
+    try
+    {
+        client_.fetchStreamAsync(url, onChunk, onComplete, headers);
+        entry->fetching = true;
+    }
+    catch (const std::exception &e)
+    {
+        Logger::Log(LogLevel::ERROR, "ContentCache::startFetch: " + std::string(e.what()));
+        if (published)
+        {
+            entry->body.reset();
+        }
+    }
+}
+
+std::shared_ptr<const ContentCache::Body> ContentCache::open(const std::string &url)
+{
+    auto entry = getEntry(url);
+
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    bool fresh = entry->body && std::chrono::steady_clock::now() - entry->fetchedAt < ttl_;
+    if (!fresh && !entry->fetching)
+    {
+        startFetch(url, entry);
+    }
+    return entry->body;
+}
+
+std::optional<size_t> ContentCache::size(const std::string &url)
+{
+    auto entry = getEntry(url);
+
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    if (entry->body)
+    {
+        if (auto complete = entry->body->completeSize())
+        {
+            return complete;
+        }
+    }
+
+    // Stat runs on FUSE workers; they are never held up by the server
+    auto now = std::chrono::steady_clock::now();
+    bool stale = entry->headAt == std::chrono::steady_clock::time_point{} || now - entry->headAt >= ttl_;
+    if (stale && !entry->heading)
+    {
+        entry->headAt = now;
+        startHead(url, entry);
+    }
+    return entry->headSize;
+}
+
+void ContentCache::startHead(const std::string &url, const std::shared_ptr<Entry> &entry)
+{
+    auto onComplete = [entry, url, onChange = onChange_](const FetchResult &result)
+    {
+        bool changed = false;
+        {
+            std::lock_guard<std::mutex> lock(entry->mutex);
+            entry->heading = false;
+            if (!result.ok || result.contentLength < 0)
+            {
+                // Keep whatever size the kernel was given; retried after the TTL
+                Logger::Log(LogLevel::WARN, "ContentCache::startHead: No size for " + url + ": " + result.error);
+                return;
+            }
+
+            auto length = static_cast<size_t>(result.contentLength);
+            changed = entry->headSize != length;
+            entry->headSize = length;
+        }
+
+        // Replace the provisional (or outdated) size the kernel holds
+        if (changed && onChange)
+        {
+            onChange(url);
+        }
+    };
+
+    try
+    {
+        client_.headAsync(url, onComplete);
+        entry->heading = true;
+    }
+    catch (const std::exception &e)
+    {
+        Logger::Log(LogLevel::ERROR, "ContentCache::startHead: " + std::string(e.what()));
+    }
+}
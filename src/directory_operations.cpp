@@ -4,130 +4,136 @@
 #include <fuse_operations.hpp>
 #include <smfs_state.hpp>
 
-// Readdir callback
-void fs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+// Fills one reply page from the handle's listing, starting at off. Each
+// entry's offset is its index + 1, so the next call resumes right after
+// the last entry that fit.
+static void replyDirPage(fuse_req_t req, size_t size, off_t off, struct fuse_file_info *fi, bool plus)
 {
-    (void)fi;
-    Logger::Log(LogLevel::DEBUG, "fs_readdir: Inode: " + std::to_string(ino));
-    Logger::Log(LogLevel::TRACE, "fs_readdir: Offset: " + std::to_string(off));
-
-    // Signal EOF for offsets greater than 0
-    if (off > 0)
+    auto *handle = reinterpret_cast<DirHandle *>(fi->fh);
+    if (!handle)
     {
-        Logger::Log(LogLevel::DEBUG, "fs_readdir: Offset > 0. No more entries to return.");
-        fuse_reply_buf(req, nullptr, 0);
+        fuse_reply_err(req, EBADF);
         return;
     }
 
-    if (inodeToPath.find(ino) == inodeToPath.end())
-    {
-        Logger::Log(LogLevel::ERROR, "fs_readdir: Inode not found: " + std::to_string(ino));
-        fuse_reply_err(req, ENOENT);
-        return;
-    }
-
-    std::string parentPath = inodeToPath[ino];
-    Logger::Log(LogLevel::DEBUG, "fs_readdir: Parent path resolved: " + parentPath);
+    std::vector<char> buf(size);
+    size_t bufSize = 0;
+    // Inodes counted for readdirplus entries in this page
+    std::vector<fuse_ino_t> counted;
 
-    if (parentPath.empty())
+    for (size_t i = static_cast<size_t>(off); i < handle->entries.size(); i++)
     {
-        parentPath = "/";
-        Logger::Log(LogLevel::DEBUG, "fs_readdir: Parent Path was empty. Assuming root: /");
-    }
+        const auto &entry = handle->entries[i];
+        size_t remaining = size - bufSize;
+        size_t entrySize;
 
-    char *buf = (char *)calloc(1, size);
-    size_t bufSize = 0;
+        bool dotEntry = entry.name == "." || entry.name == "..";
+        if (plus && !dotEntry && !inodeTable.ref(entry.ino))
+        {
+            // Removed by a reload since opendir
+            continue;
+        }
 
-    auto addDirEntry = [&](const std::string &name, fuse_ino_t inode, mode_t mode)
-    {
-        struct stat st = {};
-        st.st_ino = inode;
-        st.st_mode = mode;
+        if (plus)
+        {
+            // Attributes ride along, so ls -l needs no per-entry lookup
+            struct fuse_entry_param e = {};
+            e.ino = entry.ino;
+            fillVirtualAttr(e.attr, entry.ino, entry.name, entry.file.get());
+            e.attr_timeout = attrTimeoutFor(entry.file.get());
+            e.entry_timeout = entryTimeoutFor(entry.file.get());
+            entrySize = fuse_add_direntry_plus(req, buf.data() + bufSize, remaining, entry.name.c_str(), &e, static_cast<off_t>(i + 1));
+        }
+        else
+        {
+            struct stat st = {};
+            st.st_ino = entry.ino;
+            st.st_mode = entry.file ? S_IFREG : S_IFDIR;
+            entrySize = fuse_add_direntry(req, buf.data() + bufSize, remaining, entry.name.c_str(), &st, static_cast<off_t>(i + 1));
+        }
 
-        size_t entrySize = fuse_add_direntry(req, buf + bufSize, size - bufSize, name.c_str(), &st, bufSize + 1);
-        if (entrySize == 0 || bufSize + entrySize > size)
+        // Does not fit: the kernel asks again from this entry's offset
+        if (entrySize > remaining)
         {
-            Logger::Log(LogLevel::WARN, "fs_readdir: Buffer full or invalid entry: " + name);
-            return false;
+            if (plus && !dotEntry)
+                inodeTable.forget(entry.ino, 1);
+            break;
         }
 
         bufSize += entrySize;
-        Logger::Log(LogLevel::DEBUG, "fs_readdir: Added entry: " + name + ", inode: " + std::to_string(inode) +
-                                         ", mode: " + std::to_string(mode) + ", buffer size: " + std::to_string(bufSize));
-        return true;
-    };
-
-    addDirEntry(".", ino, S_IFDIR);
-    addDirEntry("..", FUSE_ROOT_ID, S_IFDIR);
+        // Like a lookup, each readdirplus entry except . and .. is a reference
+        if (plus && !dotEntry)
+            counted.push_back(entry.ino);
+    }
 
+    Logger::Log(LogLevel::DEBUG, "fs_readdir: Returning " + std::to_string(bufSize) + " bytes from offset " + std::to_string(off));
+    if (fuse_reply_buf(req, buf.data(), bufSize) != 0)
     {
-        std::lock_guard<std::mutex> lock(g_state->filesMutex);
-        Logger::Log(LogLevel::DEBUG, "fs_readdir: Processing entries for parent path: " + parentPath);
-
-        for (const auto &kv : g_state->files)
-        {
-            if (kv.first.find(parentPath) == 0 && kv.first != parentPath)
-            {
-                std::string relativePath;
-
-                // Handle special case where parentPath is "/"
-                if (parentPath == "/")
-                {
-                    relativePath = kv.first;
-                }
-                else
-                {
-                    relativePath = kv.first.substr(parentPath.size());
-                }
-
-                // Ensure relativePath starts with a single '/'
-                if (!relativePath.empty() && relativePath[0] == '/')
-                {
-                    relativePath = relativePath.substr(1);
-                }
-                else
-                {
-                    Logger::Log(LogLevel::TRACE, "fs_readdir: Skipping invalid relative path: " + relativePath);
-                    continue;
-                }
-
-                // Ensure it's a direct child by checking for additional '/'
-                if (relativePath.find('/') == std::string::npos)
-                {
-                    mode_t mode = kv.second ? S_IFREG : S_IFDIR;
-                    Logger::Log(LogLevel::TRACE, "fs_readdir: Adding " + std::string(mode == S_IFDIR ? "directory" : "file") +
-                                                     ": " + relativePath);
-                    if (!addDirEntry(relativePath, getInode(kv.first), mode))
-                    {
-                        Logger::Log(LogLevel::WARN, "fs_readdir: Failed to add entry: " + relativePath);
-                        break;
-                    }
-                }
-                else
-                {
-                    Logger::Log(LogLevel::TRACE, "fs_readdir: Skipping non-direct child: " + relativePath);
-                }
-            }
-        }
+        for (fuse_ino_t countedIno : counted)
+            inodeTable.forget(countedIno, 1);
     }
+}
 
-    Logger::Log(LogLevel::DEBUG, "fs_readdir: Returning buffer of size: " + std::to_string(bufSize));
-    fuse_reply_buf(req, buf, bufSize);
-    free(buf);
+// Readdir callback
+void fs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    Logger::Log(LogLevel::DEBUG, "fs_readdir: Inode: " + std::to_string(ino) + ", Offset: " + std::to_string(off));
+    replyDirPage(req, size, off, fi, false);
+}
+
+// Readdirplus callback
+void fs_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    Logger::Log(LogLevel::DEBUG, "fs_readdirplus: Inode: " + std::to_string(ino) + ", Offset: " + std::to_string(off));
+    replyDirPage(req, size, off, fi, true);
 }
 
 // Opendir callback
 void fs_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-    (void)fi;
     Logger::Log(LogLevel::DEBUG, "fs_opendir: Inode: " + std::to_string(ino));
+
+    auto handle = std::make_unique<DirHandle>();
+
+    auto inodePath = inodeTable.path(ino);
+    if (!inodePath)
+    {
+        Logger::Log(LogLevel::ERROR, "fs_opendir: Inode not found: " + std::to_string(ino));
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    const std::string &path = *inodePath;
+    size_t slash = path.rfind('/');
+    std::string parentPath = slash == 0 ? "/" : path.substr(0, slash);
+    auto parentIno = inodeTable.find(parentPath);
+    fuse_ino_t parent = ino == FUSE_ROOT_ID || !parentIno ? FUSE_ROOT_ID : *parentIno;
+
+    // The listing comes from one catalog version, read without locking
+    auto catalog = g_state->catalog.load();
+    const auto *children = catalog->children(ino);
+    handle->entries.reserve(2 + (children ? children->size() : 0));
+    handle->entries.push_back({".", ino, nullptr});
+    handle->entries.push_back({"..", parent, nullptr});
+
+    // Only this directory's own children are visited
+    if (children)
+    {
+        for (const auto &[name, node] : *children)
+        {
+            handle->entries.push_back({name, node.ino, node.file});
+        }
+    }
+
+    fi->fh = reinterpret_cast<uint64_t>(handle.release());
     fuse_reply_open(req, fi);
 }
 
 // Releasedir callback
 void fs_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-    (void)fi;
     Logger::Log(LogLevel::DEBUG, "fs_releasedir: Inode: " + std::to_string(ino));
+    delete reinterpret_cast<DirHandle *>(fi->fh);
+    fi->fh = 0;
     fuse_reply_err(req, 0);
 }
@@ -2,66 +2,106 @@
 #include "file_operations.hpp"
 #include <logger.hpp>
 #include <fuse_operations.hpp>
-#include <async_curl_client.hpp>
+#include <fuse_manager.hpp>
 #include <unistd.h>
+#include <poll.h>
 #include <string>
 #include <iostream>
 #include <smfs_state.hpp>
 
+// Per-channel ring: room for a couple of GOPs of HD video, so a new reader
+// can start at a keyframe (see StreamRing::openReader)
+constexpr size_t StreamBufferBytes = 8 * 1024 * 1024;
+
 // Open callback
 void fs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-    std::string path = inodeToPath[ino];
+    auto inodePath = inodeTable.path(ino);
+    if (!inodePath)
+    {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    std::string path = *inodePath;
     Logger::Log(LogLevel::DEBUG, "fs_open: Inode: " + std::to_string(ino) + ", Path: " + path);
 
+    bool found = false;
+    auto file = g_state->catalog.load()->find(path, found);
+
+    if (file)
     {
-        std::lock_guard<std::mutex> lock(g_state->filesMutex);
-        auto it = g_state->files.find(path);
+        auto vf = file.get();
+        auto handle = std::make_unique<FileHandle>(file);
 
-        if (it != g_state->files.end() && it->second)
+        // Handle .ts files
+        if (path.ends_with(".ts"))
         {
-            auto vf = it->second.get();
-
-            // Handle .ts files
-            if (path.ends_with(".ts"))
+            // Declared before the lock so a replaced stream, should this
+            // drop its last reference, is torn down after it is released
+            std::shared_ptr<StreamManager> retired;
+
+            // Opens of other files never wait on this one's upstream setup
+            std::lock_guard<std::mutex> streamLock(vf->streamMutex);
+            // A finished or stopped stream would only hand this open EOF;
+            // its remaining readers keep it until they release it
+            if (!vf->streamContext || vf->streamContext->isFinished() || vf->streamContext->isStopped())
             {
-                if (!vf->streamContext)
+                Logger::Log(LogLevel::DEBUG, "fs_open: Creating StreamManager for .ts file: " + path);
+                retired = std::move(vf->streamContext);
+                try
                 {
-                    Logger::Log(LogLevel::DEBUG, "fs_open: Creating StreamManager for .ts file: " + path);
-                    try
-                    {
-                        // Create an AsyncCurlClient instance
-                        std::shared_ptr<IStreamingClient> asyncClient = std::make_shared<AsyncCurlClient>();
-
-                        // Create and configure StreamManager
-                        vf->streamContext = std::make_unique<StreamManager>(vf->url, 4 * 1024 * 1024, asyncClient, g_state->isShuttingDown);
-
-                        // Start streaming in a controlled thread
-                        vf->streamContext->startStreamingThread();
-
-                        Logger::Log(LogLevel::DEBUG, "fs_open: StreamManager successfully created and started for: " + path);
-                    }
-                    catch (const std::exception &e)
-                    {
-                        Logger::Log(LogLevel::ERROR, "fs_open: Failed to create StreamManager for path: " + path + ". Error: " + e.what());
-                        vf->streamContext.reset(); // Ensure no dangling pointer
-                        fuse_reply_err(req, ENOMEM);
-                        return;
-                    }
+                    // Create and configure StreamManager
+                    vf->streamContext = std::make_shared<StreamManager>(vf->url, StreamBufferBytes, g_state->slowReaderPolicy, g_state->ingestEngine, g_state->isShuttingDown);
+
+                    // Hand the upstream transfer to the shared ingest engine
+                    vf->streamContext->startStreaming();
+
+                    Logger::Log(LogLevel::DEBUG, "fs_open: StreamManager successfully created and started for: " + path);
                 }
-                else
+                catch (const std::exception &e)
                 {
-                    Logger::Log(LogLevel::DEBUG, "fs_open: Reusing existing StreamManager for: " + path);
+                    Logger::Log(LogLevel::ERROR, "fs_open: Failed to create StreamManager for path: " + path + ". Error: " + e.what());
+                    vf->streamContext.reset(); // Ensure no dangling pointer
+                    fuse_reply_err(req, ENOMEM);
+                    return;
                 }
+            }
+            else
+            {
+                Logger::Log(LogLevel::DEBUG, "fs_open: Reusing existing StreamManager for: " + path);
+            }
+
+            // Each handle reads the stream through its own cursor
+            handle->stream = vf->streamContext;
+            handle->reader = vf->streamContext->openReader();
 
-                vf->streamContext->incrementReaderCount(); // Increment reader count
+            // Reads are answered with whatever has arrived; direct_io
+            // passes short reads through instead of treating them as EOF
+            fi->direct_io = 1;
+        }
+        else if (path.ends_with(".xml") || path.ends_with(".m3u"))
+        {
+            // Starts the download if needed; reads follow it as it grows
+            handle->content = g_state->contentCache.open(vf->url);
+            if (!handle->content)
+            {
+                Logger::Log(LogLevel::ERROR, "fs_open: Could not start fetching content for: " + path);
+                fuse_reply_err(req, EIO);
+                return;
             }
 
-            // Pass the VirtualFile pointer to file handle
-            fi->fh = reinterpret_cast<uint64_t>(vf);
-            fuse_reply_open(req, fi);
-            return;
+            // Content changes are pushed with notify_inval_inode
+            fi->keep_cache = 1;
+        }
+        else if (path.ends_with(".strm"))
+        {
+            fi->keep_cache = 1;
         }
+
+        // Pass the per-open handle to FUSE
+        fi->fh = reinterpret_cast<uint64_t>(handle.release());
+        fuse_reply_open(req, fi);
+        return;
     }
 
     Logger::Log(LogLevel::ERROR, "fs_open: File not found: " + path);
@@ -72,7 +112,13 @@ void fs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 void fs_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
 {
     (void)fi;
-    std::string path = inodeToPath[ino];
+    auto inodePath = inodeTable.path(ino);
+    if (!inodePath)
+    {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    std::string path = *inodePath;
     Logger::Log(LogLevel::DEBUG, "fs_write: Writing " + std::to_string(size) + " bytes to " + path);
 
     // Redirect writes for external files to cacheDir
@@ -88,6 +134,7 @@ void fs_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_
 
     ssize_t res = pwrite(fd, buf, size, off);
     close(fd);
+    g_state->negativeCache.erase(path);
 
     if (res == -1)
     {
@@ -102,102 +149,147 @@ void fs_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_
 // Release callback
 void fs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-    (void)fi;
-    std::lock_guard<std::mutex> lock(g_state->filesMutex);
-    std::string path = inodeToPath[ino];
+    std::string path = inodeTable.path(ino).value_or("");
     Logger::Log(LogLevel::DEBUG, "fs_release: Inode: " + std::to_string(ino) + ", Path: " + path);
 
-    auto it = g_state->files.find(path);
-    if (it != g_state->files.end() && it->second)
+    std::unique_ptr<FileHandle> handle(reinterpret_cast<FileHandle *>(fi->fh));
+    fi->fh = 0;
+
+    // Stream teardown removes the transfer from the ingest engine and waits
+    // for the engine thread to let go of it, so the last reference is
+    // dropped only after the file's stream lock is released.
+    std::shared_ptr<StreamManager> retired;
+
+    if (handle && handle->stream)
     {
-        auto vf = it->second.get();
-        if (vf->streamContext)
-        {
-            Logger::Log(LogLevel::DEBUG, "fs_release: Decrementing reader count for path: " + path);
-            vf->streamContext->decrementReaderCount();
+        auto vf = handle->file.get();
+        std::lock_guard<std::mutex> lock(vf->streamMutex);
+        Logger::Log(LogLevel::DEBUG, "fs_release: Closing reader for path: " + path);
+        handle->stream->closeReader(handle->reader);
 
-            if (vf->streamContext->isStopped())
-            {
-                Logger::Log(LogLevel::DEBUG, "fs_release: No more readers. Stopping stream: " + path);
-                vf->streamContext->stopStreaming();
-                vf->streamContext.reset(); // Release the StreamManager
-            }
+        if (handle->stream->isStopped() && vf->streamContext == handle->stream)
+        {
+            Logger::Log(LogLevel::DEBUG, "fs_release: No more readers. Stopping stream: " + path);
+            retired = std::move(vf->streamContext);
         }
     }
 
+    handle.reset();
+    retired.reset();
+
     Logger::Log(LogLevel::DEBUG, "fs_release: Inode: " + std::to_string(ino));
     fuse_reply_err(req, 0);
 }
 
+// Replies with stream bytes lent out by the ring. With spliced replies the
+// pieces go as ranges of the ring's memfd, so the payload never passes
+// through user space; otherwise libfuse writes them from the mapping.
+static void replySpan(fuse_req_t req, const StreamRing::Span &span)
+{
+    auto *manager = static_cast<FuseManager *>(fuse_req_userdata(req));
+    bool splice = span.fd >= 0 && manager && manager->SpliceWrite();
+
+    // fuse_bufvec has room for one buffer; as in libfuse's examples, the
+    // vector is allocated with room for the wrapped piece after it
+    alignas(fuse_bufvec) char storage[sizeof(fuse_bufvec) + sizeof(fuse_buf)] = {};
+    auto *vec = reinterpret_cast<fuse_bufvec *>(storage);
+
+    vec->count = span.pieces;
+    for (size_t i = 0; i < span.pieces; ++i)
+    {
+        fuse_buf &buf = vec->buf[i];
+        buf.size = span.length[i];
+        if (splice)
+        {
+            buf.flags = static_cast<fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+            buf.fd = span.fd;
+            buf.pos = static_cast<off_t>(span.offset[i]);
+        }
+        else
+        {
+            buf.mem = const_cast<char *>(span.data[i]);
+            buf.fd = -1;
+        }
+    }
+
+    // No SPLICE_MOVE: the ring's pages stay in use and must not be stolen
+    fuse_reply_data(req, vec, static_cast<fuse_buf_copy_flags>(0));
+}
+
 void fs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
 {
-    (void)fi;
-    std::string path = inodeToPath[ino];
+    std::string path = inodeTable.path(ino).value_or("");
     Logger::Log(LogLevel::DEBUG, "fs_read: Inode: " + std::to_string(ino) + ", Path: " + path);
 
+    // The handle pins its VirtualFile and stream, so no global lock is taken
+    // here: a read blocked on a slow channel must not stall other operations.
+    auto *handle = reinterpret_cast<FileHandle *>(fi->fh);
+    if (handle && handle->file)
     {
-        std::lock_guard<std::mutex> lock(g_state->filesMutex);
-        auto it = g_state->files.find(path);
+        auto vf = handle->file.get();
 
-        if (it != g_state->files.end() && it->second)
+        // Handle virtual files (.ts)
+        if (path.ends_with(".ts"))
         {
-            auto vf = it->second.get();
-            StreamManager *streamManager = vf->streamContext.get();
-
-            // Handle virtual files (.ts)
-            if (path.ends_with(".ts"))
+            if (!handle->stream || !handle->reader)
             {
-                if (!streamManager)
-                {
-                    Logger::Log(LogLevel::ERROR, "fs_read: StreamManager not found for virtual file: " + path);
-                    fuse_reply_err(req, ENOENT);
-                    return;
-                }
-
-                char *buf = new char[size];
-                size_t bytesRead = streamManager->getPipe().read(buf, size, g_state->isShuttingDown);
-
-                Logger::Log(LogLevel::TRACE, "fs_read: Virtual file read returned " + std::to_string(bytesRead) + " bytes for path: " + path);
-                fuse_reply_buf(req, buf, bytesRead);
-                delete[] buf;
+                Logger::Log(LogLevel::ERROR, "fs_read: StreamManager not found for virtual file: " + path);
+                fuse_reply_err(req, ENOENT);
                 return;
             }
 
-            // Handle other virtual files (.strm, .xml, .m3u)
-            if (path.ends_with(".strm"))
-            {
-                // Return the contentUrl as plain text
-                std::string contentUrl = vf->url;
-                Logger::Log(LogLevel::DEBUG, "fs_read: Returning contentUrl for .strm file: " + contentUrl);
+            // Parked on the stream if there is not enough data yet; the
+            // ingest thread replies, so this worker is free right away.
+            // O_NONBLOCK handles get EAGAIN instead of being parked.
+            bool wait = !(fi->flags & O_NONBLOCK);
+            handle->stream->readAsync(handle->reader, size, [req](const StreamRing::Span &data, ssize_t result)
+                                      {
+                                          if (result < 0)
+                                          {
+                                              fuse_reply_err(req, static_cast<int>(-result));
+                                              return;
+                                          }
+                                          Logger::Log(LogLevel::TRACE, "fs_read: Stream read returned " + std::to_string(result) + " bytes");
+                                          replySpan(req, data); }, wait);
+            return;
+        }
 
-                size_t toRead = std::min(size, contentUrl.size() - static_cast<size_t>(off));
-                if (static_cast<size_t>(off) >= contentUrl.size())
-                {
-                    fuse_reply_buf(req, nullptr, 0); // EOF
-                }
-                else
-                {
-                    fuse_reply_buf(req, contentUrl.data() + off, toRead);
-                }
-                return;
-            }
+        // Handle other virtual files (.strm, .xml, .m3u)
+        if (path.ends_with(".strm"))
+        {
+            // Return the contentUrl as plain text
+            const std::string &contentUrl = vf->url;
+            Logger::Log(LogLevel::DEBUG, "fs_read: Returning contentUrl for .strm file: " + contentUrl);
 
-            if (path.ends_with(".xml") || path.ends_with(".m3u"))
+            if (static_cast<size_t>(off) >= contentUrl.size())
             {
-                std::string contentUrl = vf->url;
-                if (path.ends_with(".xml"))
-                    contentUrl += ".xml";
-                else if (path.ends_with(".m3u"))
-                    contentUrl += ".m3u";
+                fuse_reply_buf(req, nullptr, 0); // EOF
+            }
+            else
+            {
+                size_t toRead = std::min(size, contentUrl.size() - static_cast<size_t>(off));
+                fuse_reply_buf(req, contentUrl.data() + off, toRead);
+            }
+            return;
+        }
 
-                Logger::Log(LogLevel::DEBUG, "fs_read: Fetching content from URL: " + contentUrl);
+        if (handle->content)
+        {
+            Logger::Log(LogLevel::DEBUG, "fs_read: Serving cached content for URL: " + vf->url);
 
-                char *buf = new char[size];
-                size_t bytesRead = streamManager->readContent(contentUrl, buf, size, off);
+            // Waits only until this range has been downloaded
+            char *buf = new char[size];
+            ssize_t bytesRead = handle->content->read(buf, size, off);
+            if (bytesRead < 0)
+            {
+                fuse_reply_err(req, static_cast<int>(-bytesRead));
+            }
+            else
+            {
                 fuse_reply_buf(req, buf, bytesRead);
-                delete[] buf;
-                return;
             }
+            delete[] buf;
+            return;
         }
     }
 
@@ -213,20 +305,51 @@ void fs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse
         return;
     }
 
-    char *buf = new char[size];
-    ssize_t res = pread(fd, buf, size, off);
+    // libfuse splices the range from the file when it can and reads it
+    // itself otherwise; it also replies with the error if that fails.
+    struct fuse_bufvec buf = {};
+    buf.count = 1;
+    buf.buf[0].size = size;
+    buf.buf[0].flags = static_cast<fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+    buf.buf[0].fd = fd;
+    buf.buf[0].pos = off;
+    int res = fuse_reply_data(req, &buf, static_cast<fuse_buf_copy_flags>(0));
     close(fd);
 
-    if (res == -1)
+    if (res != 0)
     {
-        Logger::Log(LogLevel::ERROR, "fs_read: Error reading file in cacheDir: " + cachePath);
-        delete[] buf;
-        fuse_reply_err(req, errno);
+        Logger::Log(LogLevel::ERROR, "fs_read: Error replying from cacheDir file " + cachePath + ": " + std::to_string(res));
     }
     else
     {
-        Logger::Log(LogLevel::DEBUG, "fs_read: Read " + std::to_string(res) + " bytes from cacheDir: " + cachePath);
-        fuse_reply_buf(req, buf, res);
-        delete[] buf;
+        Logger::Log(LogLevel::DEBUG, "fs_read: Replied up to " + std::to_string(size) + " bytes from cacheDir: " + cachePath);
     }
-}
\ No newline at end of file
+}
+// Poll callback. Only live streams can make a reader wait; everything else
+// is always readable.
+void fs_poll(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi, struct fuse_pollhandle *ph)
+{
+    Logger::Log(LogLevel::TRACE, "fs_poll: Inode: " + std::to_string(ino));
+
+    auto *handle = reinterpret_cast<FileHandle *>(fi->fh);
+    if (!handle || !handle->stream || !handle->reader)
+    {
+        if (ph)
+            fuse_pollhandle_destroy(ph);
+        fuse_reply_poll(req, POLLIN | POLLRDNORM);
+        return;
+    }
+
+    // The handle is destroyed with the callback, whether or not it ran
+    std::shared_ptr<fuse_pollhandle> pollHandle(ph, [](fuse_pollhandle *p)
+                                                { if (p) fuse_pollhandle_destroy(p); });
+    StreamManager::WakeCallback onReady;
+    if (pollHandle)
+    {
+        onReady = [pollHandle]()
+        { fuse_lowlevel_notify_poll(pollHandle.get()); };
+    }
+
+    bool ready = handle->stream->poll(handle->reader, std::move(onReady));
+    fuse_reply_poll(req, ready ? POLLIN | POLLRDNORM : 0);
+}
@@ -2,9 +2,10 @@
 #include "fuse_manager.hpp"
 #include "fuse_operations.hpp"
 #include "logger.hpp"
+#include <algorithm>
 
-FuseManager::FuseManager(const std::string &mountPoint)
-    : mountPoint_(mountPoint), session_(nullptr), exitRequested_(false)
+FuseManager::FuseManager(const std::string &mountPoint, const FuseOptions &options)
+    : mountPoint_(mountPoint), options_(options), session_(nullptr), exitRequested_(false)
 {
 }
 
@@ -16,6 +17,12 @@ FuseManager::~FuseManager()
 bool FuseManager::Initialize(bool debugMode)
 {
     std::vector<std::string> argsList = {"fuse_app", "-o", "allow_other"};
+    if (options_.maxRead)
+    {
+        // libfuse wants max_read both as a mount option and in init
+        argsList.push_back("-o");
+        argsList.push_back("max_read=" + std::to_string(options_.maxRead));
+    }
 
     if (debugMode)
     {
@@ -32,11 +39,16 @@ bool FuseManager::Initialize(bool debugMode)
 
     // Initialize FUSE operations
     struct fuse_lowlevel_ops ll_ops = {};
+    ll_ops.init = OnInit;
     ll_ops.lookup = fs_lookup;
+    ll_ops.forget = fs_forget;
+    ll_ops.forget_multi = fs_forget_multi;
     ll_ops.getattr = fs_getattr;
     ll_ops.readdir = fs_readdir;
+    ll_ops.readdirplus = fs_readdirplus;
     ll_ops.open = fs_open;
     ll_ops.read = fs_read;
+    ll_ops.poll = fs_poll;
     ll_ops.write = fs_write;
     ll_ops.setattr = fs_setattr;
     ll_ops.release = fs_release;
@@ -45,7 +57,7 @@ bool FuseManager::Initialize(bool debugMode)
     ll_ops.mknod = fs_mknod;
     ll_ops.getxattr = fs_getxattr;
 
-    session_ = fuse_session_new(&args, &ll_ops, sizeof(ll_ops), nullptr);
+    session_ = fuse_session_new(&args, &ll_ops, sizeof(ll_ops), this);
     if (!session_)
     {
         Logger::Log(LogLevel::ERROR, "Failed to initialize FUSE session.");
@@ -64,13 +76,106 @@ bool FuseManager::Initialize(bool debugMode)
     return true;
 }
 
+void FuseManager::OnInit(void *userdata, struct fuse_conn_info *conn)
+{
+    auto *manager = static_cast<FuseManager *>(userdata);
+    const FuseOptions &options = manager->options_;
+
+    std::string granted;
+    std::string refused;
+    auto negotiate = [&](unsigned cap, bool wanted, const char *name)
+    {
+        if (!wanted)
+        {
+            conn->want &= ~cap;
+        }
+        else if (conn->capable & cap)
+        {
+            conn->want |= cap;
+            granted += std::string(" ") + name;
+        }
+        else
+        {
+            conn->want &= ~cap;
+            refused += std::string(" ") + name;
+        }
+    };
+
+    negotiate(FUSE_CAP_ASYNC_READ, options.asyncRead, "async_read");
+    negotiate(FUSE_CAP_SPLICE_WRITE, options.spliceWrite, "splice_write");
+    negotiate(FUSE_CAP_SPLICE_MOVE, options.spliceMove, "splice_move");
+    negotiate(FUSE_CAP_SPLICE_READ, options.spliceRead, "splice_read");
+    negotiate(FUSE_CAP_WRITEBACK_CACHE, options.writebackCache, "writeback_cache");
+    manager->spliceWrite_ = (conn->want & FUSE_CAP_SPLICE_WRITE) != 0;
+
+    if (options.maxRead)
+    {
+        conn->max_read = options.maxRead;
+    }
+    if (options.maxWrite)
+    {
+        // libfuse clamps this to its receive buffer
+        conn->max_write = options.maxWrite;
+    }
+    if (options.maxReadahead)
+    {
+        // The kernel's offer is an upper bound
+        conn->max_readahead = std::min(conn->max_readahead, options.maxReadahead);
+    }
+    if (options.maxBackground)
+    {
+        conn->max_background = options.maxBackground;
+        conn->congestion_threshold = options.maxBackground * 3 / 4;
+    }
+
+    Logger::Log(LogLevel::INFO, "FuseManager::OnInit: Protocol " + std::to_string(conn->proto_major) + "." +
+                                    std::to_string(conn->proto_minor) + ", max_read " + std::to_string(conn->max_read) +
+                                    ", max_write " + std::to_string(conn->max_write) + ", max_readahead " +
+                                    std::to_string(conn->max_readahead) + ", max_background " +
+                                    std::to_string(conn->max_background) + ", enabled:" + (granted.empty() ? " none" : granted));
+    if (!refused.empty())
+    {
+        Logger::Log(LogLevel::WARN, "FuseManager::OnInit: Kernel does not offer:" + refused);
+    }
+}
+
 void FuseManager::Run()
 {
     fuseThread_ = std::thread(&FuseManager::FuseLoop, this);
+    notifyThread_ = std::thread(&FuseManager::NotifyLoop, this);
+}
+
+void FuseManager::InvalidateInode(fuse_ino_t ino)
+{
+    {
+        std::lock_guard<std::mutex> lock(notifyMutex_);
+        notifyQueue_.push_back({ino, {}});
+    }
+    notifyCondition_.notify_one();
+}
+
+void FuseManager::InvalidateEntry(fuse_ino_t parent, const std::string &name)
+{
+    {
+        std::lock_guard<std::mutex> lock(notifyMutex_);
+        notifyQueue_.push_back({parent, name});
+    }
+    notifyCondition_.notify_one();
 }
 
 void FuseManager::Stop()
 {
+    // The notifier uses the session, so it goes first
+    {
+        std::lock_guard<std::mutex> lock(notifyMutex_);
+        notifyStop_ = true;
+    }
+    notifyCondition_.notify_one();
+    if (notifyThread_.joinable())
+    {
+        notifyThread_.join();
+    }
+
     {
         std::lock_guard<std::mutex> lock(exitMutex_);
         if (!session_)
@@ -96,7 +201,7 @@ void FuseManager::Stop()
 
 void FuseManager::FuseLoop()
 {
-    struct fuse_loop_config config = {.clone_fd = 1, .max_idle_threads = 10};
+    struct fuse_loop_config config = {.clone_fd = options_.cloneFd ? 1 : 0, .max_idle_threads = options_.maxIdleThreads};
 
     Logger::Log(LogLevel::DEBUG, "Starting FUSE session loop...");
     int result = fuse_session_loop_mt(session_, &config);
@@ -116,3 +221,47 @@ void FuseManager::FuseLoop()
     }
     exitCondition_.notify_all();
 }
+
+void FuseManager::NotifyLoop()
+{
+    std::unique_lock<std::mutex> lock(notifyMutex_);
+    while (true)
+    {
+        notifyCondition_.wait(lock, [this]
+                              { return notifyStop_ || !notifyQueue_.empty(); });
+        if (notifyStop_)
+        {
+            break;
+        }
+
+        Notification notification = std::move(notifyQueue_.front());
+        notifyQueue_.pop_front();
+        lock.unlock();
+
+        int res;
+        std::string target;
+        if (notification.name.empty())
+        {
+            // Offset 0 with length 0 drops all cached pages and the attributes
+            res = fuse_lowlevel_notify_inval_inode(session_, notification.ino, 0, 0);
+            target = "inode " + std::to_string(notification.ino);
+        }
+        else
+        {
+            res = fuse_lowlevel_notify_inval_entry(session_, notification.ino, notification.name.c_str(), notification.name.size());
+            target = "entry " + notification.name + " in inode " + std::to_string(notification.ino);
+        }
+
+        if (res == 0 || res == -ENOENT)
+        {
+            // -ENOENT: the kernel had nothing cached for it
+            Logger::Log(LogLevel::DEBUG, "FuseManager::NotifyLoop: Invalidated " + target);
+        }
+        else
+        {
+            Logger::Log(LogLevel::WARN, "FuseManager::NotifyLoop: Failed to invalidate " + target + ": " + std::to_string(res));
+        }
+
+        lock.lock();
+    }
+}
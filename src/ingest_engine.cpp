@@ -0,0 +1,346 @@
+// File: ingest_engine.cpp
+#include "ingest_engine.hpp"
+#include "logger.hpp"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <climits>
+
+IngestEngine::IngestEngine()
+{
+    multiHandle_ = curl_multi_init();
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!multiHandle_ || epollFd_ == -1 || wakeFd_ == -1)
+    {
+        throw std::runtime_error("IngestEngine: Failed to initialize event loop");
+    }
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = wakeFd_;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &ev);
+
+    curl_multi_setopt(multiHandle_, CURLMOPT_SOCKETFUNCTION, socketCallback);
+    curl_multi_setopt(multiHandle_, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(multiHandle_, CURLMOPT_TIMERFUNCTION, timerCallback);
+    curl_multi_setopt(multiHandle_, CURLMOPT_TIMERDATA, this);
+
+    workerThread_ = std::thread(&IngestEngine::eventLoop, this);
+}
+
+IngestEngine::~IngestEngine()
+{
+    isRunning_ = false;
+    uint64_t one = 1;
+    (void)!::write(wakeFd_, &one, sizeof(one));
+    if (workerThread_.joinable())
+    {
+        workerThread_.join();
+    }
+    processCommands();
+
+    for (auto &[id, stream] : streams_)
+    {
+        deactivate(*stream);
+        curl_easy_cleanup(stream->easy);
+    }
+    streams_.clear();
+
+    curl_multi_cleanup(multiHandle_);
+    close(wakeFd_);
+    close(epollFd_);
+}
+
+IngestEngine::StreamId IngestEngine::addStream(const std::string &url, curl_write_callback write, void *userdata, DoneCallback onDone)
+{
+    auto stream = std::make_shared<Stream>();
+    stream->url = url;
+    stream->write = write;
+    stream->userdata = userdata;
+    stream->onDone = std::move(onDone);
+
+    StreamId id = nextId_++;
+    post({Command::Type::Add, id, std::move(stream), nullptr});
+    return id;
+}
+
+void IngestEngine::resumeStream(StreamId id)
+{
+    post({Command::Type::Resume, id, nullptr, nullptr});
+}
+
+void IngestEngine::removeStream(StreamId id)
+{
+    auto done = std::make_shared<std::promise<void>>();
+    auto finished = done->get_future();
+
+    if (std::this_thread::get_id() == workerThread_.get_id())
+    {
+        // Called from one of our own callbacks; the queue is drained after it returns.
+        post({Command::Type::Remove, id, nullptr, nullptr});
+        return;
+    }
+
+    post({Command::Type::Remove, id, nullptr, done});
+    if (isRunning_)
+    {
+        finished.wait();
+    }
+}
+
+void IngestEngine::post(Command command)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        commands_.push_back(std::move(command));
+    }
+    uint64_t one = 1;
+    (void)!::write(wakeFd_, &one, sizeof(one));
+}
+
+int IngestEngine::socketCallback(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp)
+{
+    (void)easy;
+    auto *engine = static_cast<IngestEngine *>(userp);
+
+    if (what == CURL_POLL_REMOVE)
+    {
+        epoll_ctl(engine->epollFd_, EPOLL_CTL_DEL, s, nullptr);
+        curl_multi_assign(engine->multiHandle_, s, nullptr);
+        return 0;
+    }
+
+    struct epoll_event ev = {};
+    ev.data.fd = s;
+    if (what & CURL_POLL_IN)
+        ev.events |= EPOLLIN;
+    if (what & CURL_POLL_OUT)
+        ev.events |= EPOLLOUT;
+
+    if (socketp)
+    {
+        epoll_ctl(engine->epollFd_, EPOLL_CTL_MOD, s, &ev);
+    }
+    else
+    {
+        epoll_ctl(engine->epollFd_, EPOLL_CTL_ADD, s, &ev);
+        curl_multi_assign(engine->multiHandle_, s, engine);
+    }
+    return 0;
+}
+
+int IngestEngine::timerCallback(CURLM *multi, long timeoutMs, void *userp)
+{
+    (void)multi;
+    auto *engine = static_cast<IngestEngine *>(userp);
+
+    if (timeoutMs < 0)
+    {
+        engine->timerArmed_ = false;
+    }
+    else
+    {
+        engine->timerArmed_ = true;
+        engine->timerDeadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    }
+    return 0;
+}
+
+void IngestEngine::activate(StreamId id, Stream &stream)
+{
+    if (!stream.easy)
+    {
+        stream.easy = curl_easy_init();
+        if (!stream.easy)
+        {
+            Logger::Log(LogLevel::ERROR, "IngestEngine::activate: Failed to initialize CURL for URL: " + stream.url);
+            stream.retryAt = std::chrono::steady_clock::now() + retryDelay;
+            return;
+        }
+
+        curl_easy_setopt(stream.easy, CURLOPT_URL, stream.url.c_str());
+        curl_easy_setopt(stream.easy, CURLOPT_WRITEFUNCTION, stream.write);
+        curl_easy_setopt(stream.easy, CURLOPT_WRITEDATA, stream.userdata);
+        curl_easy_setopt(stream.easy, CURLOPT_PRIVATE, reinterpret_cast<void *>(id));
+        curl_easy_setopt(stream.easy, CURLOPT_TIMEOUT, 0L);
+        curl_easy_setopt(stream.easy, CURLOPT_BUFFERSIZE, 100000L);
+        curl_easy_setopt(stream.easy, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(stream.easy, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2_0);
+        curl_easy_setopt(stream.easy, CURLOPT_NOSIGNAL, 1L);
+    }
+
+    Logger::Log(LogLevel::DEBUG, "IngestEngine::activate: Attempting stream for URL: " + stream.url);
+    curl_multi_add_handle(multiHandle_, stream.easy);
+    stream.active = true;
+}
+
+void IngestEngine::deactivate(Stream &stream)
+{
+    if (stream.active)
+    {
+        curl_multi_remove_handle(multiHandle_, stream.easy);
+        stream.active = false;
+    }
+}
+
+void IngestEngine::processCommands()
+{
+    uint64_t drained;
+    while (::read(wakeFd_, &drained, sizeof(drained)) > 0)
+    {
+    }
+
+    std::deque<Command> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending.swap(commands_);
+    }
+
+    for (auto &command : pending)
+    {
+        switch (command.type)
+        {
+        case Command::Type::Add:
+        {
+            auto &stream = streams_[command.id] = std::move(command.stream);
+            activate(command.id, *stream);
+            break;
+        }
+        case Command::Type::Resume:
+        {
+            auto it = streams_.find(command.id);
+            if (it != streams_.end() && it->second->active)
+            {
+                curl_easy_pause(it->second->easy, CURLPAUSE_CONT);
+            }
+            break;
+        }
+        case Command::Type::Remove:
+        {
+            auto it = streams_.find(command.id);
+            if (it != streams_.end())
+            {
+                deactivate(*it->second);
+                curl_easy_cleanup(it->second->easy);
+                streams_.erase(it);
+            }
+            if (command.done)
+            {
+                command.done->set_value();
+            }
+            break;
+        }
+        }
+    }
+}
+
+void IngestEngine::processCompletions()
+{
+    int numMessages;
+    CURLMsg *msg;
+    while ((msg = curl_multi_info_read(multiHandle_, &numMessages)))
+    {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+
+        void *priv = nullptr;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &priv);
+        CURLcode result = msg->data.result;
+
+        auto it = streams_.find(reinterpret_cast<StreamId>(priv));
+        if (it == streams_.end())
+            continue;
+
+        auto stream = it->second;
+        deactivate(*stream);
+
+        if (stream->onDone && stream->onDone(result))
+        {
+            Logger::Log(LogLevel::DEBUG, "IngestEngine::processCompletions: Retrying URL in " + std::to_string(retryDelay.count()) + "s: " + stream->url);
+            stream->retryAt = std::chrono::steady_clock::now() + retryDelay;
+        }
+    }
+}
+
+void IngestEngine::processRetries()
+{
+    auto now = std::chrono::steady_clock::now();
+    for (auto &[id, stream] : streams_)
+    {
+        if (!stream->active && stream->retryAt != std::chrono::steady_clock::time_point{} && stream->retryAt <= now)
+        {
+            stream->retryAt = {};
+            activate(id, *stream);
+        }
+    }
+}
+
+int IngestEngine::nextWaitMs() const
+{
+    auto now = std::chrono::steady_clock::now();
+    auto deadline = now + std::chrono::seconds(1);
+
+    if (timerArmed_)
+        deadline = std::min(deadline, timerDeadline_);
+
+    for (const auto &[id, stream] : streams_)
+    {
+        if (!stream->active && stream->retryAt != std::chrono::steady_clock::time_point{})
+            deadline = std::min(deadline, stream->retryAt);
+    }
+
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+    return static_cast<int>(std::clamp<long long>(wait, 0, INT_MAX));
+}
+
+void IngestEngine::eventLoop()
+{
+    Logger::Log(LogLevel::DEBUG, "IngestEngine::eventLoop: Started.");
+    struct epoll_event events[64];
+    int runningHandles = 0;
+
+    while (isRunning_)
+    {
+        int n = epoll_wait(epollFd_, events, 64, nextWaitMs());
+        if (n < 0 && errno != EINTR)
+        {
+            Logger::Log(LogLevel::ERROR, "IngestEngine::eventLoop: epoll_wait failed: " + std::string(strerror(errno)));
+            break;
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            if (events[i].data.fd == wakeFd_)
+            {
+                processCommands();
+                continue;
+            }
+
+            int flags = 0;
+            if (events[i].events & EPOLLIN)
+                flags |= CURL_CSELECT_IN;
+            if (events[i].events & EPOLLOUT)
+                flags |= CURL_CSELECT_OUT;
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+                flags |= CURL_CSELECT_ERR;
+            curl_multi_socket_action(multiHandle_, events[i].data.fd, flags, &runningHandles);
+        }
+
+        if (timerArmed_ && std::chrono::steady_clock::now() >= timerDeadline_)
+        {
+            timerArmed_ = false;
+            curl_multi_socket_action(multiHandle_, CURL_SOCKET_TIMEOUT, 0, &runningHandles);
+        }
+
+        processCompletions();
+        processRetries();
+    }
+
+    // Release anyone still waiting on a removal.
+    processCommands();
+    Logger::Log(LogLevel::DEBUG, "IngestEngine::eventLoop: Exiting.");
+}
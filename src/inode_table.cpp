@@ -0,0 +1,188 @@
+// File: inode_table.cpp
+#include "inode_table.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <limits>
+#include <mutex>
+
+InodeTable::InodeTable()
+{
+    // The root is never forgotten
+    inodeShard(FUSE_ROOT_ID).records[FUSE_ROOT_ID] = Record{"/", 0, 1};
+    pathShard("/").inodes["/"] = FUSE_ROOT_ID;
+    size_ = 1;
+}
+
+fuse_ino_t InodeTable::stableInode(const std::string &path)
+{
+    // FNV-1a; 0 is invalid and 1 is the root
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : path)
+    {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    return hash > FUSE_ROOT_ID ? hash : hash + FUSE_ROOT_ID + 1;
+}
+
+bool InodeTable::ownedBy(fuse_ino_t ino, const std::string &path) const
+{
+    const auto &shard = inodeShard(ino);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.records.find(ino);
+    return it != shard.records.end() && it->second.path == path;
+}
+
+fuse_ino_t InodeTable::get(const std::string &path, fuse_ino_t preferred)
+{
+    auto &shard = pathShard(path);
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.inodes.find(path);
+        if (it != shard.inodes.end() && ownedBy(it->second, path))
+        {
+            return it->second;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.inodes.find(path);
+    if (it != shard.inodes.end() && ownedBy(it->second, path))
+    {
+        return it->second;
+    }
+
+    // New, or its record was just dropped and the mapping is stale
+    fuse_ino_t ino = preferred > FUSE_ROOT_ID ? preferred : stableInode(path);
+    for (;;)
+    {
+        auto &records = inodeShard(ino);
+        std::unique_lock<std::shared_mutex> recordLock(records.mutex);
+        if (records.records.try_emplace(ino, Record{path, 0, 0}).second)
+        {
+            break;
+        }
+
+        // Held by another path: probe
+        Logger::Log(LogLevel::DEBUG, "InodeTable::get: Inode " + std::to_string(ino) + " is taken, probing for path: " + path);
+        ino = ino == std::numeric_limits<fuse_ino_t>::max() ? FUSE_ROOT_ID + 1 : ino + 1;
+    }
+    shard.inodes[path] = ino;
+    size_++;
+
+    Logger::Log(LogLevel::TRACE, "InodeTable::get: Created inode " + std::to_string(ino) + " for path: " + path);
+    return ino;
+}
+
+std::optional<fuse_ino_t> InodeTable::find(const std::string &path) const
+{
+    const auto &shard = pathShard(path);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.inodes.find(path);
+    if (it == shard.inodes.end())
+    {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+std::optional<std::string> InodeTable::path(fuse_ino_t ino) const
+{
+    const auto &shard = inodeShard(ino);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.records.find(ino);
+    if (it == shard.records.end())
+    {
+        return std::nullopt;
+    }
+    return it->second.path;
+}
+
+bool InodeTable::ref(fuse_ino_t ino)
+{
+    auto &shard = inodeShard(ino);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.records.find(ino);
+    if (it == shard.records.end())
+    {
+        return false;
+    }
+    it->second.lookups++;
+    return true;
+}
+
+void InodeTable::forget(fuse_ino_t ino, uint64_t nlookup)
+{
+    std::string path;
+    {
+        auto &shard = inodeShard(ino);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.records.find(ino);
+        if (it == shard.records.end())
+        {
+            return;
+        }
+
+        auto &record = it->second;
+        record.lookups -= std::min(nlookup, record.lookups);
+        if (record.lookups > 0 || record.pins > 0)
+        {
+            return;
+        }
+        path = std::move(record.path);
+        shard.records.erase(it);
+    }
+    remove(path, ino);
+}
+
+void InodeTable::pin(fuse_ino_t ino)
+{
+    auto &shard = inodeShard(ino);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.records.find(ino);
+    if (it != shard.records.end())
+    {
+        it->second.pins++;
+    }
+}
+
+void InodeTable::unpin(fuse_ino_t ino)
+{
+    std::string path;
+    {
+        auto &shard = inodeShard(ino);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.records.find(ino);
+        if (it == shard.records.end() || it->second.pins == 0)
+        {
+            return;
+        }
+
+        auto &record = it->second;
+        record.pins--;
+        if (record.lookups > 0 || record.pins > 0)
+        {
+            return;
+        }
+        path = std::move(record.path);
+        shard.records.erase(it);
+    }
+    remove(path, ino);
+}
+
+void InodeTable::remove(const std::string &path, fuse_ino_t ino)
+{
+    size_--;
+    auto &shard = pathShard(path);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.inodes.find(path);
+    if (it != shard.inodes.end() && it->second == ino && !ownedBy(ino, path))
+    {
+        shard.inodes.erase(it);
+    }
+    Logger::Log(LogLevel::TRACE, "InodeTable::remove: Released inode " + std::to_string(ino) + " for path: " + path);
+}
+
+size_t InodeTable::size() const
+{
+    return size_;
+}
@@ -3,54 +3,146 @@
 #include <logger.hpp>
 #include <smfs_state.hpp>
 #include <fuse_operations.hpp>
-// Lookup callback
-void fs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+
+// Size reported for a virtual file. Static kinds get their real size so the
+// kernel can cache them; streams have no end and keep INT64_MAX.
+static off_t virtualFileSize(const std::string &path, const VirtualFile &vf)
 {
-    std::string parentPath = inodeToPath[parent];
-    std::string path = parentPath + "/" + std::string(name);
+    if (path.ends_with(".strm"))
+    {
+        return static_cast<off_t>(vf.url.size());
+    }
 
-    // Normalize path: Remove redundant slashes
-    while (path.find("//") != std::string::npos)
+    if (path.ends_with(".xml") || path.ends_with(".m3u"))
     {
-        path = path.replace(path.find("//"), 2, "/");
+        if (auto size = g_state->contentCache.size(vf.url))
+        {
+            return static_cast<off_t>(*size);
+        }
     }
 
-    Logger::Log(LogLevel::DEBUG, "fs_lookup: Resolving parentPath: " + parentPath + "  path:  " + path);
+    return INT64_MAX;
+}
 
-    struct fuse_entry_param e = {};
+void fillVirtualAttr(struct stat &st, fuse_ino_t ino, const std::string &name, const VirtualFile *vf)
+{
+    st.st_ino = ino;
+    st.st_mode = vf ? S_IFREG | 0444 : S_IFDIR | 0755;
+    st.st_nlink = vf ? 1 : 2;
+    st.st_size = vf ? virtualFileSize(name, *vf) : 0;
+}
+
+double entryTimeoutFor(const VirtualFile *vf)
+{
+    return vf && vf->isUserFile ? UserFileTimeout : g_state->entryTimeout;
+}
+
+double attrTimeoutFor(const VirtualFile *vf)
+{
+    return vf && vf->isUserFile ? UserFileTimeout : g_state->attrTimeout;
+}
+
+void replyEntry(fuse_req_t req, const struct fuse_entry_param &e)
+{
+    if (fuse_reply_entry(req, &e) != 0)
     {
-        std::lock_guard<std::mutex> lock(g_state->filesMutex);
+        // The kernel never saw this reference
+        inodeTable.forget(e.ino, 1);
+    }
+}
+
+// A miss the kernel may remember for as long as we do
+static void replyNegative(fuse_req_t req)
+{
+    double timeout = std::chrono::duration<double>(g_state->negativeCache.ttl()).count();
+    if (timeout <= 0)
+    {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    // Inode 0 makes this a negative dentry; no lookup count is taken
+    struct fuse_entry_param e = {};
+    e.entry_timeout = timeout;
+    fuse_reply_entry(req, &e);
+}
+
+// Lookup callback
+void fs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    Logger::Log(LogLevel::DEBUG, "fs_lookup: Parent inode: " + std::to_string(parent) + ", Name: " + name);
+
+    struct fuse_entry_param e = {};
+    auto catalog = g_state->catalog.load();
 
-        // Search in in-memory files map
-        auto it = g_state->files.find(path);
-        if (it != g_state->files.end())
+    // One probe of the (parent, name) index
+    if (const auto *node = catalog->lookup(parent, name))
+    {
+        // A reload may have dropped the entry, and its inode, since this
+        // version was loaded
+        if (!inodeTable.ref(node->ino))
         {
-            e.ino = getInode(path);
-            e.attr.st_ino = e.ino;
-            e.attr.st_mode = it->second ? S_IFREG | 0444 : S_IFDIR | 0755;
-            e.attr.st_nlink = it->second ? 1 : 2;
-            e.attr.st_size = it->second ? INT64_MAX : 0;
-
-            Logger::Log(LogLevel::TRACE, "fs_lookup: Resolved inode attributes for path: " + path);
-            fuse_reply_entry(req, &e);
+            Logger::Log(LogLevel::DEBUG, "fs_lookup: Entry removed meanwhile: " + std::string(name));
+            fuse_reply_err(req, ENOENT);
             return;
         }
+
+        const VirtualFile *vf = node->file.get();
+        e.ino = node->ino;
+        fillVirtualAttr(e.attr, e.ino, name, vf);
+        e.attr_timeout = attrTimeoutFor(vf);
+        e.entry_timeout = entryTimeoutFor(vf);
+
+        Logger::Log(LogLevel::TRACE, "fs_lookup: Resolved inode attributes for: " + std::string(name));
+        replyEntry(req, e);
+        return;
+    }
+
+    std::string parentPath = inodeTable.path(parent).value_or("");
+    if (parentPath.empty())
+    {
+        Logger::Log(LogLevel::ERROR, "fs_lookup: Parent inode not found: " + std::to_string(parent));
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    std::string path = (parentPath == "/" ? "" : parentPath) + "/" + name;
+
+    // SMFS's own data in cacheDir is not part of the mount
+    if (isPrivatePath(path))
+    {
+        replyNegative(req);
+        return;
     }
 
     // Check cacheDir for the file
+    // Players probe for lots of sidecar files that are not there
+    auto &misses = g_state->negativeCache;
+    if (misses.isMissing(path))
+    {
+        Logger::Log(LogLevel::TRACE, "fs_lookup: Known miss: " + path);
+        replyNegative(req);
+        return;
+    }
+
     std::string cachePath = g_state->cacheDir + path;
     struct stat st;
     if (lstat(cachePath.c_str(), &st) == 0)
     {
-        std::lock_guard<std::mutex> lock(g_state->filesMutex);
-
-        // Add to in-memory file map if not already present
-        if (g_state->files.find(path) == g_state->files.end())
-        {
-            g_state->files[path] = std::make_shared<VirtualFile>(cachePath, st.st_size);
-        }
-
-        e.ino = getInode(path);
+        // Add to the catalog if not already present
+        g_state->updateCatalog([&](Catalog &next)
+                               {
+                                   bool known = false;
+                                   next.find(path, known);
+                                   if (!known)
+                                   {
+                                       auto vf = std::make_shared<VirtualFile>(cachePath, st.st_size);
+                                       vf->isUserFile = true; // Survives catalog reloads
+                                       next.set(path, std::move(vf));
+                                   }
+
+                                   // Counted while no other writer can drop it
+                                   e.ino = getInode(path);
+                                   inodeTable.ref(e.ino); });
         e.attr.st_ino = e.ino;
         e.attr.st_mode = st.st_mode;
         e.attr.st_nlink = st.st_nlink;
@@ -60,14 +152,17 @@ void fs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
         e.attr.st_atime = st.st_atime;
         e.attr.st_mtime = st.st_mtime;
         e.attr.st_ctime = st.st_ctime;
+        e.attr_timeout = UserFileTimeout;
+        e.entry_timeout = UserFileTimeout;
 
         Logger::Log(LogLevel::DEBUG, "fs_lookup: Found file in cacheDir: " + cachePath);
-        fuse_reply_entry(req, &e);
+        replyEntry(req, e);
         return;
     }
 
-    Logger::Log(LogLevel::ERROR, "fs_lookup: Path not found: " + path);
-    fuse_reply_err(req, ENOENT);
+    Logger::Log(LogLevel::DEBUG, "fs_lookup: Path not found: " + path);
+    misses.addMiss(path);
+    replyNegative(req);
 }
 
 // Getattr callback
@@ -83,46 +178,60 @@ void fs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
         st.st_mode = S_IFDIR | 0755;
         st.st_nlink = 2;
         Logger::Log(LogLevel::DEBUG, "fs_getattr: Returning attributes for root directory.");
-        fuse_reply_attr(req, &st, 1.0);
+        fuse_reply_attr(req, &st, g_state->attrTimeout);
         return;
     }
 
-    auto it = inodeToPath.find(ino);
-    if (it == inodeToPath.end())
+    auto inodePath = inodeTable.path(ino);
+    if (!inodePath)
     {
         Logger::Log(LogLevel::ERROR, "fs_getattr: Inode not found: " + std::to_string(ino));
         fuse_reply_err(req, ENOENT);
         return;
     }
 
-    std::string path = it->second;
+    std::string path = *inodePath;
     Logger::Log(LogLevel::DEBUG, "fs_getattr: Path resolved for inode: " + path);
 
+    bool found = false;
+    auto vf = g_state->catalog.load()->find(path, found);
+
+    if (found)
     {
-        std::lock_guard<std::mutex> lock(g_state->filesMutex);
-        auto fileIt = g_state->files.find(path);
-        if (fileIt != g_state->files.end())
-        {
-            st.st_ino = ino;
-            st.st_mode = fileIt->second ? S_IFREG | 0444 : S_IFDIR | 0755;
-            st.st_nlink = fileIt->second ? 1 : 2;
-            st.st_size = fileIt->second ? INT64_MAX : 0;
-            Logger::Log(LogLevel::DEBUG, "fs_getattr: Returning attributes for path: " + path);
-            fuse_reply_attr(req, &st, 1.0);
-            return;
-        }
+        fillVirtualAttr(st, ino, path, vf.get());
+        Logger::Log(LogLevel::DEBUG, "fs_getattr: Returning attributes for path: " + path);
+        fuse_reply_attr(req, &st, attrTimeoutFor(vf.get()));
+        return;
     }
 
     // Check cacheDir for the file
     std::string cachePath = g_state->cacheDir + path;
-    if (lstat(cachePath.c_str(), &st) == 0)
+    if (!isPrivatePath(path) && !g_state->negativeCache.isMissing(path) && lstat(cachePath.c_str(), &st) == 0)
     {
         st.st_ino = ino; // Assign the correct inode
         Logger::Log(LogLevel::DEBUG, "fs_getattr: Returning attributes from cacheDir for path: " + cachePath);
-        fuse_reply_attr(req, &st, 1.0);
+        fuse_reply_attr(req, &st, UserFileTimeout);
         return;
     }
 
     Logger::Log(LogLevel::ERROR, "fs_getattr: Path not found: " + path);
     fuse_reply_err(req, ENOENT);
 }
+
+// Forget callback: the kernel dropped nlookup references to ino
+void fs_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup)
+{
+    Logger::Log(LogLevel::TRACE, "fs_forget: Inode: " + std::to_string(ino) + ", Count: " + std::to_string(nlookup));
+    inodeTable.forget(ino, nlookup);
+    fuse_reply_none(req);
+}
+
+void fs_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets)
+{
+    Logger::Log(LogLevel::TRACE, "fs_forget_multi: Forgetting " + std::to_string(count) + " inodes");
+    for (size_t i = 0; i < count; i++)
+    {
+        inodeTable.forget(forgets[i].ino, forgets[i].nlookup);
+    }
+    fuse_reply_none(req);
+}
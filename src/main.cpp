@@ -25,7 +25,8 @@ std::unique_ptr<FuseManager> fuseManager;
 
 void loadConfig(const std::string &configPath, std::string &host, std::string &port, std::string &apiKey,
                 std::string &mountPoint, std::string &cacheDir, std::set<std::string> &enabledFileTypes,
-                bool &isShort, LogLevel &logLevel)
+                bool &isShort, LogLevel &logLevel, SlowReaderPolicy &slowReaderPolicy, int &contentCacheTtl,
+                double &entryTimeout, double &attrTimeout, double &negativeTimeout, FuseOptions &fuseOptions)
 {
     std::ifstream configFile(configPath);
     if (!configFile.is_open())
@@ -43,6 +44,11 @@ void loadConfig(const std::string &configPath, std::string &host, std::string &p
     cacheDir = config.value("cacheDir", cacheDir);
     logLevel = config.value("logLevel", logLevel);
 
+    if (config.contains("slowReaderPolicy"))
+    {
+        slowReaderPolicy = ParseSlowReaderPolicy(config["slowReaderPolicy"].get<std::string>());
+    }
+
     if (config.contains("enabledFileTypes") && config["enabledFileTypes"].is_array())
     {
         enabledFileTypes.clear();
@@ -53,6 +59,26 @@ void loadConfig(const std::string &configPath, std::string &host, std::string &p
     }
 
     isShort = config.value("isShort", isShort);
+    contentCacheTtl = config.value("contentCacheTtl", contentCacheTtl);
+    entryTimeout = config.value("entryTimeout", entryTimeout);
+    attrTimeout = config.value("attrTimeout", attrTimeout);
+    negativeTimeout = config.value("negativeTimeout", negativeTimeout);
+
+    if (config.contains("fuse") && config["fuse"].is_object())
+    {
+        const auto &fuse = config["fuse"];
+        fuseOptions.maxRead = fuse.value("maxRead", fuseOptions.maxRead);
+        fuseOptions.maxWrite = fuse.value("maxWrite", fuseOptions.maxWrite);
+        fuseOptions.maxReadahead = fuse.value("maxReadahead", fuseOptions.maxReadahead);
+        fuseOptions.maxBackground = fuse.value("maxBackground", fuseOptions.maxBackground);
+        fuseOptions.asyncRead = fuse.value("asyncRead", fuseOptions.asyncRead);
+        fuseOptions.spliceWrite = fuse.value("spliceWrite", fuseOptions.spliceWrite);
+        fuseOptions.spliceMove = fuse.value("spliceMove", fuseOptions.spliceMove);
+        fuseOptions.spliceRead = fuse.value("spliceRead", fuseOptions.spliceRead);
+        fuseOptions.writebackCache = fuse.value("writebackCache", fuseOptions.writebackCache);
+        fuseOptions.cloneFd = fuse.value("cloneFd", fuseOptions.cloneFd);
+        fuseOptions.maxIdleThreads = fuse.value("maxIdleThreads", fuseOptions.maxIdleThreads);
+    }
 }
 
 // Signal handler to gracefully exit
@@ -96,16 +122,23 @@ void parseEnableFlag(const std::string &arg, std::set<std::string> &enabledFileT
 
 void stopAllStreams()
 {
-    std::lock_guard<std::mutex> lock(g_state->filesMutex);
-    for (auto &file : g_state->files)
-    {
-        if (file.second && file.second->streamContext)
+    // Streams are joined after their locks are released so in-flight FUSE
+    // operations can still complete.
+    std::vector<std::shared_ptr<StreamManager>> retired;
+    auto catalog = g_state->catalog.load();
+    catalog->forEachFile([&](const std::string &path, const std::shared_ptr<VirtualFile> &file)
+                         {
+        if (!file)
+            return;
+
+        std::lock_guard<std::mutex> lock(file->streamMutex);
+        if (file->streamContext)
         {
-            Logger::Log(LogLevel::INFO, "Stopping stream for path: " + file.first);
-            file.second->streamContext->stopStreaming();
-            file.second->streamContext.reset();
-        }
-    }
+            Logger::Log(LogLevel::INFO, "Stopping stream for path: " + path);
+            file->streamContext->stopStreaming();
+            retired.push_back(std::move(file->streamContext));
+        } });
+    retired.clear();
 }
 
 int main(int argc, char *argv[])
@@ -125,6 +158,12 @@ int main(int argc, char *argv[])
     std::string cacheDir = "/tmp/smfs_storage";
     std::string streamGroupProfileIds;
     bool isShort = true;
+    SlowReaderPolicy slowReaderPolicy = SlowReaderPolicy::Skip;
+    int contentCacheTtl = 300;
+    double entryTimeout = 60.0;
+    double attrTimeout = 60.0;
+    double negativeTimeout = 10.0;
+    FuseOptions fuseOptions;
     std::set<std::string> enabledFileTypes{"xml", "m3u", "ts"};
 
     // Check for --config option and load configuration file
@@ -140,7 +179,8 @@ int main(int argc, char *argv[])
 
     try
     {
-        loadConfig(configFilePath, host, port, apiKey, mountPoint, cacheDir, enabledFileTypes, isShort, logLevel);
+        loadConfig(configFilePath, host, port, apiKey, mountPoint, cacheDir, enabledFileTypes, isShort, logLevel, slowReaderPolicy, contentCacheTtl,
+                   entryTimeout, attrTimeout, negativeTimeout, fuseOptions);
         Logger::Log(LogLevel::INFO, "Configuration loaded from: " + configFilePath);
     }
     catch (const std::exception &e)
@@ -164,6 +204,12 @@ int main(int argc, char *argv[])
                       << "--mount <mountpoint>            Set the FUSE mount point\n"
                       << "--isShort=true/false            Set the short URL\n"
                       << "--cacheDir <path>               Specify the cache directory\n"
+                      << "--slow-reader-policy <policy>   What to do with a lagging .ts reader (block, skip, disconnect)\n"
+                      << "--content-cache-ttl <seconds>   How long cached .xml/.m3u content is served before revalidation\n"
+                      << "--entry-timeout <seconds>       How long the kernel may cache catalog names\n"
+                      << "--attr-timeout <seconds>        How long the kernel may cache catalog attributes\n"
+                      << "--negative-timeout <seconds>    How long names missing from cacheDir are remembered (0 = off)\n"
+                      << "--max-idle-threads <n>          Idle FUSE worker threads kept around\n"
                       << "--enable-<filetype>=true/false  Enable or disable specific file types (e.g., ts, strm, m3u, xml)\n";
             exit(0);
         }
@@ -204,6 +250,30 @@ int main(int argc, char *argv[])
         {
             cacheDir = argv[++i];
         }
+        else if (arg == "--slow-reader-policy" && i + 1 < argc)
+        {
+            slowReaderPolicy = ParseSlowReaderPolicy(argv[++i]);
+        }
+        else if (arg == "--content-cache-ttl" && i + 1 < argc)
+        {
+            contentCacheTtl = std::stoi(argv[++i]);
+        }
+        else if (arg == "--entry-timeout" && i + 1 < argc)
+        {
+            entryTimeout = std::stod(argv[++i]);
+        }
+        else if (arg == "--attr-timeout" && i + 1 < argc)
+        {
+            attrTimeout = std::stod(argv[++i]);
+        }
+        else if (arg == "--negative-timeout" && i + 1 < argc)
+        {
+            negativeTimeout = std::stod(argv[++i]);
+        }
+        else if (arg == "--max-idle-threads" && i + 1 < argc)
+        {
+            fuseOptions.maxIdleThreads = static_cast<unsigned>(std::stoul(argv[++i]));
+        }
         else
         {
             parseEnableFlag(arg, enabledFileTypes);
@@ -223,15 +293,7 @@ int main(int argc, char *argv[])
     Logger::SetDebug(debugMode);
     Logger::Log(LogLevel::INFO, "SMFS starting...");
 
-    // Initialize FuseManager
-    fuseManager = std::make_unique<FuseManager>(mountPoint);
-    inodeToPath[FUSE_ROOT_ID] = "/";
-    pathToInode["/"] = FUSE_ROOT_ID;
-    if (!fuseManager->Initialize(debugMode))
-    {
-        Logger::Log(LogLevel::ERROR, "Failed to initialize FUSE.");
-        return 1;
-    }
+    curl_global_init(CURL_GLOBAL_ALL);
 
     // Create global SMFS state
     g_state = std::make_unique<SMFS>(host, port, apiKey, streamGroupProfileIds, isShort);
@@ -239,12 +301,91 @@ int main(int argc, char *argv[])
     g_state->cacheDir = cacheDir;
     Logger::Log(LogLevel::INFO, "Cache directory set to: " + cacheDir);
     g_state->enabledFileTypes = std::move(enabledFileTypes);
+    g_state->slowReaderPolicy = slowReaderPolicy;
+    g_state->entryTimeout = entryTimeout;
+    g_state->attrTimeout = attrTimeout;
+    g_state->contentCache.setTtl(std::chrono::seconds(contentCacheTtl));
+    const std::string privateDir = cacheDir + "/" + std::string(PrivateDirName);
+    g_state->contentCache.setPersistDir(privateDir + "/content");
+    g_state->apiClient.setChangeCallback([](const std::vector<std::string> &paths)
+                                         {
+                                             // Drop the kernel's dentries for every path a reload touched,
+                                             // and the attributes of inodes that live on under a new URL
+                                             std::vector<std::pair<fuse_ino_t, std::string>> entries;
+                                             std::vector<fuse_ino_t> inodes;
+                                             for (const auto &path : paths)
+                                             {
+                                                 size_t slash = path.rfind('/');
+                                                 std::string parent = slash == 0 ? "/" : path.substr(0, slash);
+                                                 if (auto ino = inodeTable.find(parent))
+                                                 {
+                                                     entries.emplace_back(*ino, path.substr(slash + 1));
+                                                 }
+                                                 if (auto ino = inodeTable.find(path))
+                                                 {
+                                                     inodes.push_back(*ino);
+                                                 }
+                                             }
+                                             for (const auto &[parent, name] : entries)
+                                             {
+                                                 fuseManager->InvalidateEntry(parent, name);
+                                             }
+                                             for (fuse_ino_t ino : inodes)
+                                             {
+                                                 fuseManager->InvalidateInode(ino);
+                                             } });
+    g_state->contentCache.setChangeCallback([](const std::string &url)
+                                            {
+                                                // Drop the kernel's pages and size for every file serving url
+                                                std::vector<fuse_ino_t> inodes;
+                                                auto catalog = g_state->catalog.load();
+                                                if (const auto *paths = catalog->contentPaths(url))
+                                                {
+                                                    for (const auto &path : *paths)
+                                                    {
+                                                        if (auto ino = inodeTable.find(path))
+                                                        {
+                                                            inodes.push_back(*ino);
+                                                        }
+                                                    }
+                                                }
+                                                for (fuse_ino_t ino : inodes)
+                                                {
+                                                    fuseManager->InvalidateInode(ino);
+                                                } });
 
     for (const auto &fileType : g_state->enabledFileTypes)
     {
         Logger::Log(LogLevel::INFO, "Enabled file type: " + fileType);
     }
 
+    // Serve the last good catalog from the moment the mount appears; the
+    // API fetch after the WebSocket handshake reconciles it.
+    g_state->apiClient.setSnapshotPath(privateDir + "/catalog.bin");
+    g_state->apiClient.loadSnapshot();
+
+    // Initialize FuseManager
+    fuseManager = std::make_unique<FuseManager>(mountPoint, fuseOptions);
+    if (!fuseManager->Initialize(debugMode))
+    {
+        Logger::Log(LogLevel::ERROR, "Failed to initialize FUSE.");
+        return 1;
+    }
+
+    // Files appearing in cacheDir end the kernel's negative dentries too
+    g_state->negativeCache.start(cacheDir, std::chrono::milliseconds(static_cast<long long>(negativeTimeout * 1000)),
+                                 [](const std::vector<std::string> &paths)
+                                 {
+                                     for (const auto &path : paths)
+                                     {
+                                         size_t slash = path.rfind('/');
+                                         std::string parent = slash == 0 ? "/" : path.substr(0, slash);
+                                         if (auto ino = inodeTable.find(parent))
+                                         {
+                                             fuseManager->InvalidateEntry(*ino, path.substr(slash + 1));
+                                         }
+                                     } });
+
     // Start WebSocket client
     WebSocketClient wsClient(host, port);
     std::thread wsThread([&wsClient]()
@@ -260,6 +401,7 @@ int main(int argc, char *argv[])
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(500));
     }
+    g_state->isShuttingDown = true;
     stopAllStreams();
 
     wsClient.Stop();
@@ -270,9 +412,13 @@ int main(int argc, char *argv[])
         Logger::Log(LogLevel::INFO, "WebSocket client thread joined.");
     }
 
-    // Stop FUSE
+    // Stop FUSE, and first everything that queues notifications for it
+    g_state->negativeCache.stop();
     fuseManager->Stop();
 
+    g_state.reset();
+    curl_global_cleanup();
+
     Logger::Log(LogLevel::INFO, "SMFS exited cleanly.");
     return 0;
 }
@@ -0,0 +1,233 @@
+// File: negative_lookup_cache.cpp
+#include "negative_lookup_cache.hpp"
+#include "logger.hpp"
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+NegativeLookupCache::~NegativeLookupCache()
+{
+    stop();
+}
+
+void NegativeLookupCache::start(const std::string &cacheDir, std::chrono::milliseconds ttl, DropCallback onDrop)
+{
+    cacheDir_ = cacheDir;
+    ttl_ = ttl;
+    onDrop_ = std::move(onDrop);
+    if (ttl_.count() <= 0)
+    {
+        return;
+    }
+
+    inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stopFd_ = eventfd(0, EFD_CLOEXEC);
+    if (inotifyFd_ < 0 || stopFd_ < 0)
+    {
+        // Misses still expire after the TTL
+        Logger::Log(LogLevel::WARN, "NegativeLookupCache::start: inotify unavailable, relying on expiry: " + std::string(strerror(errno)));
+        if (inotifyFd_ >= 0)
+            close(inotifyFd_);
+        if (stopFd_ >= 0)
+            close(stopFd_);
+        inotifyFd_ = stopFd_ = -1;
+        return;
+    }
+
+    watchThread_ = std::thread(&NegativeLookupCache::watchLoop, this);
+}
+
+void NegativeLookupCache::stop()
+{
+    if (watchThread_.joinable())
+    {
+        uint64_t one = 1;
+        [[maybe_unused]] ssize_t n = write(stopFd_, &one, sizeof(one));
+        watchThread_.join();
+    }
+    if (inotifyFd_ >= 0)
+    {
+        close(inotifyFd_);
+        inotifyFd_ = -1;
+    }
+    if (stopFd_ >= 0)
+    {
+        close(stopFd_);
+        stopFd_ = -1;
+    }
+}
+
+bool NegativeLookupCache::isMissing(const std::string &path) const
+{
+    if (ttl_.count() <= 0)
+    {
+        return false;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = misses_.find(path);
+    return it != misses_.end() && it->second > Clock::now();
+}
+
+void NegativeLookupCache::addMiss(const std::string &path)
+{
+    if (ttl_.count() <= 0)
+    {
+        return;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (misses_.size() >= MaxEntries)
+    {
+        auto now = Clock::now();
+        std::erase_if(misses_, [now](const auto &miss)
+                      { return miss.second <= now; });
+        if (misses_.size() >= MaxEntries)
+        {
+            misses_.clear();
+        }
+    }
+
+    misses_[path] = Clock::now() + ttl_;
+    if (inotifyFd_ >= 0)
+    {
+        watchAncestor(path);
+    }
+}
+
+void NegativeLookupCache::erase(const std::string &path)
+{
+    if (ttl_.count() <= 0)
+    {
+        return;
+    }
+
+    std::vector<std::string> dropped;
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    dropTree(path, dropped);
+}
+
+void NegativeLookupCache::watchAncestor(const std::string &path)
+{
+    // Nearest existing directory above path; "" is cacheDir itself
+    std::string dir = path;
+    struct stat st;
+    do
+    {
+        size_t slash = dir.rfind('/');
+        dir = slash == std::string::npos ? "" : dir.substr(0, slash);
+    } while (!dir.empty() && (stat((cacheDir_ + dir).c_str(), &st) != 0 || !S_ISDIR(st.st_mode)));
+
+    if (watchedDirs_.contains(dir))
+    {
+        return;
+    }
+
+    int wd = inotify_add_watch(inotifyFd_, (cacheDir_ + dir).c_str(), IN_CREATE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+    if (wd < 0)
+    {
+        // e.g. out of watches; these misses just wait for expiry
+        Logger::Log(LogLevel::DEBUG, "NegativeLookupCache::watchAncestor: Cannot watch " + cacheDir_ + dir + ": " + strerror(errno));
+        return;
+    }
+
+    watches_[wd] = dir;
+    watchedDirs_[dir] = wd;
+}
+
+void NegativeLookupCache::dropTree(const std::string &path, std::vector<std::string> &dropped)
+{
+    auto it = misses_.find(path);
+    if (it != misses_.end())
+    {
+        dropped.push_back(it->first);
+        misses_.erase(it);
+    }
+
+    // Siblings such as "/X.nfo" sort between "/X" and "/X/...", so the
+    // children are a range of their own
+    std::string prefix = path + "/";
+    it = misses_.lower_bound(prefix);
+    while (it != misses_.end() && it->first.starts_with(prefix))
+    {
+        dropped.push_back(it->first);
+        it = misses_.erase(it);
+    }
+}
+
+void NegativeLookupCache::watchLoop()
+{
+    alignas(struct inotify_event) char buf[16 * 1024];
+    struct pollfd fds[2] = {{inotifyFd_, POLLIN, 0}, {stopFd_, POLLIN, 0}};
+
+    while (true)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            Logger::Log(LogLevel::ERROR, "NegativeLookupCache::watchLoop: poll failed: " + std::string(strerror(errno)));
+            return;
+        }
+        if (fds[1].revents)
+        {
+            return;
+        }
+
+        ssize_t len = read(inotifyFd_, buf, sizeof(buf));
+        if (len <= 0)
+        {
+            continue;
+        }
+
+        std::vector<std::string> dropped;
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            for (ssize_t off = 0; off < len;)
+            {
+                const auto *event = reinterpret_cast<const struct inotify_event *>(buf + off);
+                off += sizeof(struct inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW)
+                {
+                    // Events were lost: nothing cached can be trusted
+                    for (const auto &miss : misses_)
+                        dropped.push_back(miss.first);
+                    misses_.clear();
+                    continue;
+                }
+
+                auto watch = watches_.find(event->wd);
+                if (watch == watches_.end())
+                {
+                    continue;
+                }
+
+                if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                {
+                    dropTree(watch->second + "/" + event->name, dropped);
+                }
+                if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+                {
+                    // Misses below it are re-watched from a new ancestor on
+                    // the next addMiss; until then they only expire
+                    watchedDirs_.erase(watch->second);
+                    watches_.erase(watch);
+                }
+            }
+        }
+
+        if (!dropped.empty())
+        {
+            Logger::Log(LogLevel::DEBUG, "NegativeLookupCache::watchLoop: Dropped " + std::to_string(dropped.size()) + " misses");
+            if (onDrop_)
+            {
+                onDrop_(dropped);
+            }
+        }
+    }
+}
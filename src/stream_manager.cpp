@@ -5,27 +5,33 @@
 #include <cstring>
 #include <algorithm>
 #include <stdexcept>
-#include <thread>
-#include <stop_token>
-#include <future>
+#include <cerrno>
 
-StreamManager::StreamManager(const std::string &url, size_t bufferCapacity, std::shared_ptr<IStreamingClient> client, std::atomic<bool> &shutdownFlag)
-    : url_(url), pipe_(bufferCapacity), client_(std::move(client)), isShuttingDown_(shutdownFlag) {}
+StreamManager::StreamManager(const std::string &url, size_t bufferCapacity, SlowReaderPolicy policy, IngestEngine &engine, std::atomic<bool> &shutdownFlag)
+    : url_(url), ring_(bufferCapacity, policy), engine_(engine), isShuttingDown_(shutdownFlag) {}
 
-void StreamManager::incrementReaderCount()
+std::shared_ptr<StreamRing::Reader> StreamManager::openReader()
 {
     std::lock_guard<std::mutex> lock(mutex_);
     ++readerCount_;
     stopRequested_ = false;
-    Logger::Log(LogLevel::DEBUG, "StreamManager::incrementReaderCount: Reader count increased to " + std::to_string(readerCount_));
+    Logger::Log(LogLevel::DEBUG, "StreamManager::openReader: Reader count increased to " + std::to_string(readerCount_));
+    return ring_.openReader();
 }
 
-void StreamManager::decrementReaderCount()
+void StreamManager::closeReader(const std::shared_ptr<StreamRing::Reader> &reader)
 {
     std::lock_guard<std::mutex> lock(mutex_);
+    serveParked(true, reader.get()); // Nothing will be read through it any more
+    ring_.closeReader(reader);
+    resumeIfPaused(); // The slowest reader may just have left
+    if (reader->skippedBytes > 0)
+    {
+        Logger::Log(LogLevel::WARN, "StreamManager::closeReader: Reader skipped " + std::to_string(reader->skippedBytes) + " bytes of " + url_ + " while falling behind.");
+    }
     if (--readerCount_ <= 0)
     {
-        Logger::Log(LogLevel::DEBUG, "StreamManager::decrementReaderCount: No readers left, stopping stream.");
+        Logger::Log(LogLevel::DEBUG, "StreamManager::closeReader: No readers left, stopping stream.");
         stopStreaming();
     }
 }
@@ -33,190 +39,224 @@ void StreamManager::decrementReaderCount()
 void StreamManager::startStreaming()
 {
     Logger::Log(LogLevel::INFO, "StreamManager::startStreaming: Starting stream for URL: " + url_);
-    client_->fetchStreamAsync(url_, [this](const std::string &data)
-                              {
-        if (!pipe_.write(data.data(), data.size(), stopRequested_))
-        {
-            Logger::Log(LogLevel::ERROR, "StreamManager::startStreaming: Failed to write data to pipe.");
-        } });
+    streamId_ = engine_.addStream(url_, writeCallback, this, [this](CURLcode result)
+                                  { return onTransferDone(result); });
 }
 
 void StreamManager::stopStreaming()
 {
     Logger::Log(LogLevel::INFO, "StreamManager::stopStreaming: Stopping stream for URL: " + url_);
     stopRequested_ = true;
+    serveParked(true);
 }
 
-void StreamManager::startStreamingThread()
+void StreamManager::readAsync(const std::shared_ptr<StreamRing::Reader> &reader, size_t size, ReadCallback complete, bool wait)
 {
-    streamingThread_ = std::jthread([this](std::stop_token stopToken)
-                                    {
-        (void)stopToken;
-        
-        try
-        {
-            streamingThreadFunc();
-        }
-        catch (const std::exception &e)
-        {
-            Logger::Log(LogLevel::ERROR, "StreamManager::startStreamingThread: Exception occurred: " + std::string(e.what()));
-        } });
-}
+    std::lock_guard<std::mutex> lock(parkedMutex_);
+    ParkedRead read{reader, size, std::move(complete)};
 
-void StreamManager::stopStreamingThread()
-{
-    if (streamingThread_.joinable())
+    // Raised before trying, so data written after the attempt always finds
+    // this read (see writeCallback)
+    hasParked_ = true;
+
+    bool queuedBehind = std::any_of(parked_.begin(), parked_.end(), [&](const ParkedRead &other)
+                                    { return other.reader == reader; });
+    bool stopping = stopRequested_ || isShuttingDown_.load();
+    if (!wait && (queuedBehind || !tryComplete(read, stopping ? 0 : 1)))
     {
-        Logger::Log(LogLevel::INFO, "StreamManager::stopStreamingThread: Requesting thread stop for URL: " + url_);
-        streamingThread_.request_stop();
-        streamingThread_.join();
+        read.complete({}, -EAGAIN);
     }
+    else if (wait && (queuedBehind || !tryComplete(read, stopping ? 0 : MinReplyBytes)))
+    {
+        parked_.push_back(std::move(read));
+        return;
+    }
+    hasParked_ = !parked_.empty() || !pollers_.empty();
 }
 
-const std::string &StreamManager::getUrl() const
-{
-    return url_;
-}
-
-Pipe &StreamManager::getPipe()
+bool StreamManager::poll(const std::shared_ptr<StreamRing::Reader> &reader, WakeCallback onReady)
 {
-    return pipe_;
-}
+    std::lock_guard<std::mutex> lock(parkedMutex_);
+    hasParked_ = true; // As in readAsync: armed before checking
 
-bool StreamManager::isStopped() const
-{
-    return stopRequested_;
-}
+    // A parked read will take the data first
+    bool queuedBehind = std::any_of(parked_.begin(), parked_.end(), [&](const ParkedRead &other)
+                                    { return other.reader == reader; });
+    bool ready = stopRequested_ || isShuttingDown_.load() || (!queuedBehind && ring_.readable(*reader));
 
-size_t StreamManager::readContent(const std::string &toFetchUrl, char *buf, size_t size, off_t offset)
-{
-    return fetchUrlContent(toFetchUrl, buf, size, offset);
+    std::erase_if(pollers_, [&](const auto &poller)
+                  { return poller.first == reader.get(); });
+    if (!ready && onReady)
+    {
+        pollers_.emplace_back(reader.get(), std::move(onReady));
+    }
+    hasParked_ = !parked_.empty() || !pollers_.empty();
+    return ready;
 }
 
-StreamManager::~StreamManager()
+bool StreamManager::tryComplete(ParkedRead &read, size_t minBytes)
 {
-    Logger::Log(LogLevel::INFO, "StreamManager::~StreamManager: Cleaning up StreamManager for URL: " + url_);
-    stopStreamingThread();
+    // The reply goes out straight from the ring
+    StreamRing::Span span;
+    switch (ring_.peek(*read.reader, read.size, minBytes, span))
+    {
+    case StreamRing::ReadStatus::Pending:
+        return false;
+    case StreamRing::ReadStatus::Data:
+        read.complete(span, static_cast<ssize_t>(span.size));
+        ring_.consume(*read.reader, span);
+        resumeIfPaused(); // The writer may have paused on the pin
+        break;
+    case StreamRing::ReadStatus::End:
+        read.complete({}, 0);
+        break;
+    case StreamRing::ReadStatus::Disconnected:
+        Logger::Log(LogLevel::WARN, "StreamManager::tryComplete: Reader disconnected for falling behind on " + url_);
+        read.complete({}, -EIO);
+        break;
+    }
+    return true;
 }
 
-size_t StreamManager::WriteCallback(void *contents, size_t size, size_t nmemb, void *userp)
+void StreamManager::serveParked(bool flush, const StreamRing::Reader *reader)
 {
-    size_t totalSize = size * nmemb;
-    std::string *str = static_cast<std::string *>(userp);
-    str->append(static_cast<char *>(contents), totalSize);
-    return totalSize;
-}
+    if (!hasParked_)
+    {
+        return;
+    }
 
-size_t StreamManager::writeCallback(char *ptr, size_t size, size_t nmemb, void *userdata)
-{
-    auto *manager = reinterpret_cast<StreamManager *>(userdata);
-    size_t total = size * nmemb;
+    std::lock_guard<std::mutex> lock(parkedMutex_);
 
-    if (manager->stopRequested_)
+    // A cursor whose oldest read must wait keeps its later reads waiting too
+    std::vector<const StreamRing::Reader *> waiting;
+    for (auto it = parked_.begin(); it != parked_.end();)
     {
-        Logger::Log(LogLevel::INFO, "StreamManager::writeCallback: Stop requested. Exiting write.");
-        return 0; // Inform CURL to stop
+        const auto *current = it->reader.get();
+        if ((reader && current != reader) || std::find(waiting.begin(), waiting.end(), current) != waiting.end())
+        {
+            ++it;
+            continue;
+        }
+
+        if (tryComplete(*it, flush ? 0 : MinReplyBytes))
+        {
+            it = parked_.erase(it);
+        }
+        else
+        {
+            waiting.push_back(current);
+            ++it;
+        }
     }
 
-    if (!manager->pipe_.write(ptr, total, manager->stopRequested_))
+    // Pollers whose cursor has data left over (or is done) are woken
+    for (auto it = pollers_.begin(); it != pollers_.end();)
     {
-        if (manager->stopRequested_)
+        bool mine = !reader || it->first == reader;
+        bool blocked = std::find(waiting.begin(), waiting.end(), it->first) != waiting.end();
+        if (mine && (flush || (!blocked && ring_.readable(*it->first))))
         {
-            Logger::Log(LogLevel::INFO, "StreamManager::writeCallback: Write aborted due to stop request.");
-            return 0; // Stop without logging an error
+            it->second();
+            it = pollers_.erase(it);
+        }
+        else
+        {
+            ++it;
         }
-
-        Logger::Log(LogLevel::ERROR, "StreamManager::writeCallback: Failed to write to pipe.");
-        return 0; // Inform CURL of failure
     }
 
-    Logger::Log(LogLevel::DEBUG, "StreamManager::writeCallback: Wrote " + std::to_string(total) + " bytes to pipe.");
-    return total;
+    hasParked_ = !parked_.empty() || !pollers_.empty();
 }
 
-size_t StreamManager::fetchUrlContent(const std::string &url, char *buf, size_t size, off_t offset)
+void StreamManager::resumeIfPaused()
 {
-    CURL *curl = curl_easy_init();
-    if (!curl)
+    if (paused_.exchange(false))
     {
-        Logger::Log(LogLevel::ERROR, "StreamManager::fetchUrlContent: Failed to initialize CURL.");
-        return 0;
+        engine_.resumeStream(streamId_);
     }
+}
 
-    CURLcode res;
-    std::string retrievedData;
-
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &retrievedData);
-
-    res = curl_easy_perform(curl);
-    curl_easy_cleanup(curl);
-
-    if (res != CURLE_OK)
+// Runs on the ingest engine thread. Returns true to have the engine retry.
+bool StreamManager::onTransferDone(CURLcode result)
+{
+    if (stopRequested_ || isShuttingDown_.load())
     {
-        Logger::Log(LogLevel::ERROR, "StreamManager::fetchUrlContent: CURL error: " + std::string(curl_easy_strerror(res)));
-        return 0;
+        Logger::Log(LogLevel::INFO, "StreamManager::onTransferDone: Stream stopped by request for URL: " + url_);
+        return false;
     }
 
-    if (static_cast<std::make_unsigned_t<off_t>>(offset) >= retrievedData.size())
+    if (result != CURLE_OK)
     {
-        return 0;
+        Logger::Log(LogLevel::ERROR, "StreamManager::onTransferDone: CURL error: " + std::string(curl_easy_strerror(result)) + " for URL: " + url_);
+        return true;
     }
 
-    size_t toRead = std::min(size, retrievedData.size() - offset);
-    memcpy(buf, retrievedData.data() + offset, toRead);
-    return toRead;
+    Logger::Log(LogLevel::INFO, "StreamManager::onTransferDone: Stream completed successfully for URL: " + url_);
+    ring_.finish();
+    finished_ = true;
+    serveParked(false); // Drain what is left, then EOF
+    return false;
 }
 
-void StreamManager::streamingThreadFunc()
+const std::string &StreamManager::getUrl() const
 {
-    Logger::Log(LogLevel::INFO, "StreamManager::streamingThreadFunc: Starting stream for URL: " + url_);
+    return url_;
+}
 
-    CURL *curl = curl_easy_init();
-    if (!curl)
+bool StreamManager::isStopped() const
+{
+    return stopRequested_;
+}
+
+bool StreamManager::isFinished() const
+{
+    return finished_;
+}
+
+StreamManager::~StreamManager()
+{
+    Logger::Log(LogLevel::INFO, "StreamManager::~StreamManager: Cleaning up StreamManager for URL: " + url_);
+    if (streamId_)
     {
-        Logger::Log(LogLevel::ERROR, "StreamManager::streamingThreadFunc: Failed to initialize CURL.");
-        return;
+        engine_.removeStream(streamId_);
     }
+    serveParked(true); // Never leave a request unanswered
+}
 
-    curl_easy_setopt(curl, CURLOPT_URL, url_.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, this);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 0L);
-    curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, 100000L);
-    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
-    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2_0);
-    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+// Runs on the ingest engine thread; must never block.
+size_t StreamManager::writeCallback(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    auto *manager = reinterpret_cast<StreamManager *>(userdata);
+    size_t total = size * nmemb;
 
-    while (!stopRequested_ && !isShuttingDown_.load())
+    if (manager->stopRequested_)
     {
-        Logger::Log(LogLevel::DEBUG, "StreamManager::streamingThreadFunc: Attempting stream for URL: " + url_);
-        CURLcode res = curl_easy_perform(curl);
+        Logger::Log(LogLevel::INFO, "StreamManager::writeCallback: Stop requested. Exiting write.");
+        return 0; // Inform CURL to stop
+    }
 
-        if (res == CURLE_ABORTED_BY_CALLBACK && stopRequested_)
-        {
-            Logger::Log(LogLevel::INFO, "StreamManager::streamingThreadFunc: Stream stopped by request for URL: " + url_);
-            break;
-        }
-        else if (res != CURLE_OK)
-        {
-            Logger::Log(LogLevel::ERROR, "StreamManager::streamingThreadFunc: CURL error: " + std::string(curl_easy_strerror(res)));
-            if (isShuttingDown_.load())
-            {
-                Logger::Log(LogLevel::INFO, "StreamManager::streamingThreadFunc: Exiting due to shutdown for URL: " + url_);
-                break;
-            }
-            std::this_thread::sleep_for(std::chrono::seconds(5));
-        }
-        else
+    if (!manager->ring_.tryWrite(ptr, total))
+    {
+        // Block policy and the slowest reader is a full ring behind, or a
+        // reply in flight has pinned the bytes this chunk would overwrite:
+        // park the transfer until a read frees space. curl re-delivers this
+        // chunk.
+        // The flag is raised before retrying so a read that frees space in
+        // between is guaranteed to see it and resume us.
+        manager->paused_ = true;
+        if (manager->ring_.tryWrite(ptr, total))
         {
-            Logger::Log(LogLevel::INFO, "StreamManager::streamingThreadFunc: Stream completed successfully for URL: " + url_);
-            break;
+            manager->paused_ = false;
+            manager->serveParked(false);
+            return total;
         }
+        Logger::Log(LogLevel::DEBUG, "StreamManager::writeCallback: Ring full, pausing upstream for " + manager->url_);
+        return CURL_WRITEFUNC_PAUSE;
     }
 
-    curl_easy_cleanup(curl);
-    Logger::Log(LogLevel::INFO, "StreamManager::streamingThreadFunc: Exiting for URL: " + url_);
+    Logger::Log(LogLevel::DEBUG, "StreamManager::writeCallback: Wrote " + std::to_string(total) + " bytes to ring.");
+
+    // Parked FUSE reads are answered from here, so no FUSE worker waits
+    manager->serveParked(false);
+    return total;
 }
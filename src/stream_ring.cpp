@@ -0,0 +1,267 @@
+// File: stream_ring.cpp
+#include "stream_ring.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+SlowReaderPolicy ParseSlowReaderPolicy(const std::string &policyStr)
+{
+    std::string policy = policyStr;
+    std::transform(policy.begin(), policy.end(), policy.begin(), ::tolower);
+
+    if (policy == "block")
+        return SlowReaderPolicy::Block;
+    if (policy == "skip")
+        return SlowReaderPolicy::Skip;
+    if (policy == "disconnect")
+        return SlowReaderPolicy::Disconnect;
+
+    throw std::invalid_argument("Invalid slow reader policy: " + policyStr);
+}
+
+StreamRing::StreamRing(size_t capacity, SlowReaderPolicy policy)
+    : capacity_(capacity), policy_(policy)
+{
+    fd_ = memfd_create("smfs_ring", MFD_CLOEXEC);
+    if (fd_ >= 0 && ftruncate(fd_, static_cast<off_t>(capacity_)) == 0)
+    {
+        void *map = mmap(nullptr, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (map != MAP_FAILED)
+        {
+            buffer_ = static_cast<char *>(map);
+            return;
+        }
+    }
+
+    Logger::Log(LogLevel::WARN, "StreamRing: memfd buffer unavailable, replies will be copied: " + std::string(strerror(errno)));
+    if (fd_ >= 0)
+    {
+        close(fd_);
+        fd_ = -1;
+    }
+    heapBuffer_.reset(new char[capacity_]);
+    buffer_ = heapBuffer_.get();
+}
+
+StreamRing::~StreamRing()
+{
+    if (fd_ >= 0)
+    {
+        munmap(buffer_, capacity_);
+        close(fd_);
+    }
+}
+
+std::shared_ptr<StreamRing::Reader> StreamRing::openReader()
+{
+    auto reader = std::make_shared<Reader>();
+    std::lock_guard<std::mutex> lock(mutex_);
+    reader->pos = writePos_;
+
+    if (start_.synced && start_.packetStart >= oldestRetained())
+    {
+        reader->pos = start_.packetStart;
+        reader->headers = start_.headers;
+
+        // A keyframe too far back would leave the reader little headroom
+        // before the writer laps (or, under Block, stalls on) it
+        if (start_.headers && start_.randomAccess && *start_.randomAccess >= oldestRetained() &&
+            writePos_ - *start_.randomAccess <= capacity_ / 2)
+        {
+            reader->pos = *start_.randomAccess;
+            Logger::Log(LogLevel::DEBUG, "StreamRing::openReader: Starting " + std::to_string(writePos_ - reader->pos) + " bytes back, at the latest keyframe.");
+        }
+    }
+
+    readers_.push_back(reader);
+    return reader;
+}
+
+void StreamRing::closeReader(const std::shared_ptr<Reader> &reader)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::erase(readers_, reader);
+    }
+}
+
+uint64_t StreamRing::oldestRetained() const
+{
+    return reserveEnd_ > capacity_ ? reserveEnd_ - capacity_ : 0;
+}
+
+uint64_t StreamRing::slowestReader() const
+{
+    uint64_t slowest = writePos_;
+    for (const auto &reader : readers_)
+    {
+        if (!reader->disconnected)
+            slowest = std::min(slowest, reader->pos);
+    }
+    return slowest;
+}
+
+// Bytes the writer may append without overwriting what it must keep:
+// unread data under Block, and spans pinned by peek under any policy.
+size_t StreamRing::freeSpace() const
+{
+    uint64_t keep = policy_ == SlowReaderPolicy::Block ? slowestReader() : writePos_;
+    for (const auto &reader : readers_)
+    {
+        if (reader->pinned)
+            keep = std::min(keep, reader->pos);
+    }
+    return capacity_ - static_cast<size_t>(writePos_ - keep);
+}
+
+void StreamRing::disconnectLapped()
+{
+    uint64_t oldest = oldestRetained();
+    for (auto &reader : readers_)
+    {
+        if (!reader->disconnected && reader->pos < oldest)
+        {
+            reader->disconnected = true;
+            Logger::Log(LogLevel::WARN, "StreamRing: Disconnecting slow reader " + std::to_string(oldest - reader->pos) + " bytes behind.");
+        }
+    }
+}
+
+// Copies one batch that is known to fit. Called and returns with lock held.
+void StreamRing::append(std::unique_lock<std::mutex> &lock, const char *data, size_t len)
+{
+    uint64_t start = writePos_;
+    reserveEnd_ = start + len;
+    if (policy_ == SlowReaderPolicy::Disconnect)
+        disconnectLapped();
+    lock.unlock();
+
+    copyIn(start, data, len);
+    tracker_.feed(data, len);
+
+    lock.lock();
+    writePos_ = reserveEnd_;
+    start_ = tracker_.startPoint();
+}
+
+bool StreamRing::tryWrite(const char *data, size_t len)
+{
+    std::lock_guard<std::mutex> writerLock(writeMutex_);
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    size_t space = freeSpace();
+    if (space < capacity_)
+    {
+        // Something must be kept; write all of it or nothing
+        if (space < len)
+            return false;
+        append(lock, data, len);
+        return true;
+    }
+
+    for (size_t written = 0; written < len;)
+    {
+        size_t batch = std::min(capacity_, len - written);
+        append(lock, data + written, batch);
+        written += batch;
+    }
+    return true;
+}
+
+void StreamRing::finish()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+}
+
+StreamRing::ReadStatus StreamRing::peek(Reader &reader, size_t len, size_t minBytes, Span &span)
+{
+    std::lock_guard<std::mutex> readerLock(reader.readMutex);
+    std::lock_guard<std::mutex> lock(mutex_);
+    span = Span{};
+
+    if (reader.disconnected)
+        return ReadStatus::Disconnected;
+
+    if (reader.headers)
+    {
+        span.size = std::min(reader.headers->size() - reader.headersSent, len);
+        span.data[0] = reader.headers->data() + reader.headersSent;
+        span.length[0] = span.size;
+        span.pieces = 1;
+        span.headers = true;
+        return ReadStatus::Data;
+    }
+
+    // Past this, nothing from reader.pos on is being overwritten: the writer
+    // only copies outside the lock into [writePos_, reserveEnd_), and a
+    // reader lapped by that span is moved (or cut off) here first.
+    uint64_t oldest = oldestRetained();
+    if (reader.pos < oldest)
+    {
+        if (policy_ == SlowReaderPolicy::Disconnect)
+        {
+            reader.disconnected = true;
+            return ReadStatus::Disconnected;
+        }
+        reader.skippedBytes += oldest - reader.pos;
+        reader.pos = oldest;
+    }
+
+    size_t available = static_cast<size_t>(writePos_ - reader.pos);
+    if (available == 0 && finished_)
+        return ReadStatus::End;
+    if (available < std::min(minBytes, len) && !finished_)
+        return ReadStatus::Pending;
+
+    span.size = std::min(available, len);
+    span.fd = fd_;
+    size_t offset = static_cast<size_t>(reader.pos % capacity_);
+    size_t first = std::min(span.size, capacity_ - offset);
+    span.data[0] = buffer_ + offset;
+    span.offset[0] = offset;
+    span.length[0] = first;
+    span.pieces = 1;
+    if (first < span.size)
+    {
+        span.data[1] = buffer_;
+        span.length[1] = span.size - first;
+        span.pieces = 2;
+    }
+
+    reader.pinned = true;
+    return ReadStatus::Data;
+}
+
+void StreamRing::consume(Reader &reader, const Span &span)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (span.headers)
+    {
+        reader.headersSent += span.size;
+        if (reader.headersSent == reader.headers->size())
+            reader.headers.reset();
+        return;
+    }
+
+    reader.pinned = false;
+    reader.pos += span.size;
+}
+
+bool StreamRing::readable(const Reader &reader) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return reader.disconnected || finished_ || reader.headers || writePos_ > reader.pos;
+}
+
+void StreamRing::copyIn(uint64_t pos, const char *src, size_t len)
+{
+    size_t offset = static_cast<size_t>(pos % capacity_);
+    size_t first = std::min(len, capacity_ - offset);
+    std::memcpy(buffer_ + offset, src, first);
+    std::memcpy(buffer_, src + first, len - first);
+}
@@ -0,0 +1,229 @@
+// File: ts_scan.cpp
+#include "ts_scan.hpp"
+#include "logger.hpp"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SMFS_TS_SCAN_X86 1
+#endif
+
+namespace
+{
+    constexpr size_t PacketSize = 188;
+    constexpr uint8_t SyncByte = 0x47;
+
+    uint32_t loadHeader(const uint8_t *packet)
+    {
+        uint32_t word;
+        std::memcpy(&word, packet, sizeof(word));
+        return word;
+    }
+
+    // The header word as loaded (little endian: sync, flags/PID high, PID
+    // low, control/CC) rearranged into TsHeader::bits. The vector kernels
+    // apply the same shifts and masks to every lane.
+    uint32_t decodeWord(uint32_t word)
+    {
+        return (word & 0x1F00) | ((word >> 16) & 0xFF) // PID
+               | ((word >> 8) & 0xF0000)                // Continuity counter
+               | ((word << 9) & TsHeader::Error)
+               | ((word << 11) & TsHeader::UnitStart)
+               | ((word >> 2) & (TsHeader::Payload | TsHeader::Adaptation));
+    }
+
+    size_t decodeScalar(const uint8_t *data, size_t count, TsHeader *out)
+    {
+        for (size_t k = 0; k < count; ++k)
+        {
+            uint32_t word = loadHeader(data + k * PacketSize);
+            out[k].bits = decodeWord(word);
+            if ((word & 0xFF) != SyncByte)
+                return k;
+        }
+        return count;
+    }
+
+    size_t findSyncFrom(const uint8_t *data, size_t len, size_t from)
+    {
+        for (size_t i = from; i + 2 * PacketSize < len; ++i)
+        {
+            if (data[i] == SyncByte && data[i + PacketSize] == SyncByte && data[i + 2 * PacketSize] == SyncByte)
+                return i;
+        }
+        return len;
+    }
+
+    size_t findSyncScalar(const uint8_t *data, size_t len)
+    {
+        return findSyncFrom(data, len, 0);
+    }
+
+#ifdef SMFS_TS_SCAN_X86
+    // SSE2 has no gather: four headers are loaded one by one, then decoded
+    // together.
+    __attribute__((target("sse2"))) __m128i decodeLanes(__m128i word)
+    {
+        __m128i pid = _mm_or_si128(_mm_and_si128(word, _mm_set1_epi32(0x1F00)),
+                                   _mm_and_si128(_mm_srli_epi32(word, 16), _mm_set1_epi32(0xFF)));
+        __m128i cc = _mm_and_si128(_mm_srli_epi32(word, 8), _mm_set1_epi32(0xF0000));
+        __m128i error = _mm_and_si128(_mm_slli_epi32(word, 9), _mm_set1_epi32(TsHeader::Error));
+        __m128i unitStart = _mm_and_si128(_mm_slli_epi32(word, 11), _mm_set1_epi32(TsHeader::UnitStart));
+        __m128i control = _mm_and_si128(_mm_srli_epi32(word, 2), _mm_set1_epi32(TsHeader::Payload | TsHeader::Adaptation));
+        return _mm_or_si128(_mm_or_si128(pid, cc), _mm_or_si128(_mm_or_si128(error, unitStart), control));
+    }
+
+    __attribute__((target("sse2"))) size_t decodeSse2(const uint8_t *data, size_t count, TsHeader *out)
+    {
+        size_t k = 0;
+        for (; k + 4 <= count; k += 4)
+        {
+            const uint8_t *p = data + k * PacketSize;
+            __m128i word = _mm_setr_epi32(static_cast<int>(loadHeader(p)), static_cast<int>(loadHeader(p + PacketSize)),
+                                          static_cast<int>(loadHeader(p + 2 * PacketSize)), static_cast<int>(loadHeader(p + 3 * PacketSize)));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + k), decodeLanes(word));
+
+            __m128i sync = _mm_cmpeq_epi32(_mm_and_si128(word, _mm_set1_epi32(0xFF)), _mm_set1_epi32(SyncByte));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(sync)));
+            if (mask != 0xF)
+                return k + static_cast<size_t>(__builtin_ctz(~mask));
+        }
+        return k + decodeScalar(data + k * PacketSize, count - k, out + k);
+    }
+
+    __attribute__((target("sse2"))) size_t findSyncSse2(const uint8_t *data, size_t len)
+    {
+        const __m128i sync = _mm_set1_epi8(static_cast<char>(SyncByte));
+        size_t i = 0;
+        for (; i + 2 * PacketSize + 16 <= len; i += 16)
+        {
+            __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)), sync);
+            __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + PacketSize)), sync);
+            __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 2 * PacketSize)), sync);
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(a, _mm_and_si128(b, c))));
+            if (mask)
+                return i + static_cast<size_t>(__builtin_ctz(mask));
+        }
+        return findSyncFrom(data, len, i);
+    }
+
+    __attribute__((target("avx2"))) size_t decodeAvx2(const uint8_t *data, size_t count, TsHeader *out)
+    {
+        const __m256i offsets = _mm256_setr_epi32(0, 188, 376, 564, 752, 940, 1128, 1316);
+        size_t k = 0;
+        for (; k + 8 <= count; k += 8)
+        {
+            __m256i word = _mm256_i32gather_epi32(reinterpret_cast<const int *>(data + k * PacketSize), offsets, 1);
+
+            __m256i pid = _mm256_or_si256(_mm256_and_si256(word, _mm256_set1_epi32(0x1F00)),
+                                          _mm256_and_si256(_mm256_srli_epi32(word, 16), _mm256_set1_epi32(0xFF)));
+            __m256i cc = _mm256_and_si256(_mm256_srli_epi32(word, 8), _mm256_set1_epi32(0xF0000));
+            __m256i error = _mm256_and_si256(_mm256_slli_epi32(word, 9), _mm256_set1_epi32(TsHeader::Error));
+            __m256i unitStart = _mm256_and_si256(_mm256_slli_epi32(word, 11), _mm256_set1_epi32(TsHeader::UnitStart));
+            __m256i control = _mm256_and_si256(_mm256_srli_epi32(word, 2), _mm256_set1_epi32(TsHeader::Payload | TsHeader::Adaptation));
+            __m256i bits = _mm256_or_si256(_mm256_or_si256(pid, cc), _mm256_or_si256(_mm256_or_si256(error, unitStart), control));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + k), bits);
+
+            __m256i sync = _mm256_cmpeq_epi32(_mm256_and_si256(word, _mm256_set1_epi32(0xFF)), _mm256_set1_epi32(SyncByte));
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(sync)));
+            if (mask != 0xFF)
+                return k + static_cast<size_t>(__builtin_ctz(~mask));
+        }
+        return k + decodeScalar(data + k * PacketSize, count - k, out + k);
+    }
+
+    __attribute__((target("avx2"))) size_t findSyncAvx2(const uint8_t *data, size_t len)
+    {
+        const __m256i sync = _mm256_set1_epi8(static_cast<char>(SyncByte));
+        size_t i = 0;
+        for (; i + 2 * PacketSize + 32 <= len; i += 32)
+        {
+            __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)), sync);
+            __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + PacketSize)), sync);
+            __m256i c = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 2 * PacketSize)), sync);
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_and_si256(a, _mm256_and_si256(b, c))));
+            if (mask)
+                return i + static_cast<size_t>(__builtin_ctz(mask));
+        }
+        return findSyncFrom(data, len, i);
+    }
+
+    // GCC 12's AVX-512 intrinsics start from _mm512_undefined_epi32(), which
+    // it then reports as maybe uninitialized
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+    __attribute__((target("avx512f,avx512bw"))) size_t decodeAvx512(const uint8_t *data, size_t count, TsHeader *out)
+    {
+        const __m512i offsets = _mm512_setr_epi32(0, 188, 376, 564, 752, 940, 1128, 1316,
+                                                  1504, 1692, 1880, 2068, 2256, 2444, 2632, 2820);
+        size_t k = 0;
+        for (; k + 16 <= count; k += 16)
+        {
+            __m512i word = _mm512_i32gather_epi32(offsets, data + k * PacketSize, 1);
+
+            __m512i pid = _mm512_or_si512(_mm512_and_si512(word, _mm512_set1_epi32(0x1F00)),
+                                          _mm512_and_si512(_mm512_srli_epi32(word, 16), _mm512_set1_epi32(0xFF)));
+            __m512i cc = _mm512_and_si512(_mm512_srli_epi32(word, 8), _mm512_set1_epi32(0xF0000));
+            __m512i error = _mm512_and_si512(_mm512_slli_epi32(word, 9), _mm512_set1_epi32(TsHeader::Error));
+            __m512i unitStart = _mm512_and_si512(_mm512_slli_epi32(word, 11), _mm512_set1_epi32(TsHeader::UnitStart));
+            __m512i control = _mm512_and_si512(_mm512_srli_epi32(word, 2), _mm512_set1_epi32(TsHeader::Payload | TsHeader::Adaptation));
+            __m512i bits = _mm512_or_si512(_mm512_or_si512(pid, cc), _mm512_or_si512(_mm512_or_si512(error, unitStart), control));
+            _mm512_storeu_si512(out + k, bits);
+
+            unsigned mask = _mm512_cmpeq_epi32_mask(_mm512_and_si512(word, _mm512_set1_epi32(0xFF)), _mm512_set1_epi32(SyncByte));
+            if (mask != 0xFFFF)
+                return k + static_cast<size_t>(__builtin_ctz(~mask));
+        }
+        return k + decodeScalar(data + k * PacketSize, count - k, out + k);
+    }
+
+    __attribute__((target("avx512f,avx512bw"))) size_t findSyncAvx512(const uint8_t *data, size_t len)
+    {
+        const __m512i sync = _mm512_set1_epi8(static_cast<char>(SyncByte));
+        size_t i = 0;
+        for (; i + 2 * PacketSize + 64 <= len; i += 64)
+        {
+            uint64_t mask = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(data + i), sync) &
+                            _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(data + i + PacketSize), sync) &
+                            _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(data + i + 2 * PacketSize), sync);
+            if (mask)
+                return i + static_cast<size_t>(__builtin_ctzll(mask));
+        }
+        return findSyncFrom(data, len, i);
+    }
+#pragma GCC diagnostic pop
+#endif
+
+    const TsScanKernel ScalarKernel{"scalar", decodeScalar, findSyncScalar};
+#ifdef SMFS_TS_SCAN_X86
+    const TsScanKernel Sse2Kernel{"sse2", decodeSse2, findSyncSse2};
+    const TsScanKernel Avx2Kernel{"avx2", decodeAvx2, findSyncAvx2};
+    const TsScanKernel Avx512Kernel{"avx512", decodeAvx512, findSyncAvx512};
+#endif
+}
+
+std::vector<const TsScanKernel *> supportedTsScanKernels()
+{
+    std::vector<const TsScanKernel *> kernels{&ScalarKernel};
+#ifdef SMFS_TS_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        kernels.push_back(&Sse2Kernel);
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back(&Avx2Kernel);
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        kernels.push_back(&Avx512Kernel);
+#endif
+    return kernels;
+}
+
+const TsScanKernel &bestTsScanKernel()
+{
+    static const TsScanKernel &best = []() -> const TsScanKernel &
+    {
+        const TsScanKernel &kernel = *supportedTsScanKernels().back();
+        Logger::Log(LogLevel::INFO, std::string("TsScan: Using the ") + kernel.name + " kernel.");
+        return kernel;
+    }();
+    return best;
+}
@@ -0,0 +1,338 @@
+// File: ts_tracker.cpp
+#include "ts_tracker.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <cstring>
+
+void TsTracker::feed(const char *data, size_t len)
+{
+    uint64_t pos = pos_;
+    pos_ += len;
+
+    if (start_.synced)
+    {
+        scan(reinterpret_cast<const uint8_t *>(data), len, pos);
+        return;
+    }
+
+    if (carry_.empty())
+    {
+        carryPos_ = pos;
+    }
+    carry_.append(data, len);
+    search();
+}
+
+// Looks for packet alignment in carry_ and, once found, parses from there.
+void TsTracker::search()
+{
+    // Three sync bytes a packet apart; one alone is common in payload
+    constexpr size_t Window = 2 * PacketSize + 1;
+    size_t i = kernel_.findSync(reinterpret_cast<const uint8_t *>(carry_.data()), carry_.size());
+    if (i < carry_.size())
+    {
+        Logger::Log(LogLevel::DEBUG, "TsTracker::search: Packets aligned at stream offset " + std::to_string(carryPos_ + i));
+        std::string pending = carry_.substr(i);
+        uint64_t pos = carryPos_ + i;
+        carry_.clear();
+        start_.synced = true;
+        videoCc_ = -1;
+        scan(reinterpret_cast<const uint8_t *>(pending.data()), pending.size(), pos);
+        return;
+    }
+
+    // Keep only what could still begin an aligned run
+    if (carry_.size() >= Window)
+    {
+        size_t drop = carry_.size() - (Window - 1);
+        carry_.erase(0, drop);
+        carryPos_ += drop;
+    }
+}
+
+// Parses whole packets of an aligned stream; bytes[0] is at stream position
+// pos and continues the packet carried over from the previous call, if any.
+void TsTracker::scan(const uint8_t *bytes, size_t len, uint64_t pos)
+{
+    size_t i = 0;
+    if (!carry_.empty())
+    {
+        i = std::min(PacketSize - carry_.size(), len);
+        carry_.append(reinterpret_cast<const char *>(bytes), i);
+        if (carry_.size() < PacketSize)
+        {
+            start_.packetStart = carryPos_;
+            return;
+        }
+
+        TsHeader header;
+        const auto *packet = reinterpret_cast<const uint8_t *>(carry_.data());
+        if (kernel_.decode(packet, 1, &header) == 1)
+        {
+            parsePacket(packet, header, carryPos_);
+            carry_.clear();
+        }
+        else
+        {
+            std::string rest = carry_;
+            uint64_t restPos = carryPos_;
+            rest.append(reinterpret_cast<const char *>(bytes + i), len - i);
+            carry_.clear();
+            lostSync(reinterpret_cast<const uint8_t *>(rest.data()), rest.size(), restPos);
+            return;
+        }
+    }
+
+    TsHeader headers[Batch];
+    while (i + PacketSize <= len)
+    {
+        size_t count = std::min(Batch, (len - i) / PacketSize);
+        size_t synced = kernel_.decode(bytes + i, count, headers);
+        for (size_t k = 0; k < synced; ++k)
+        {
+            parsePacket(bytes + i + k * PacketSize, headers[k], pos + i + k * PacketSize);
+        }
+        i += synced * PacketSize;
+        if (synced < count)
+        {
+            lostSync(bytes + i, len - i, pos + i);
+            return;
+        }
+    }
+
+    carry_.assign(reinterpret_cast<const char *>(bytes + i), len - i);
+    carryPos_ = pos + i;
+    start_.packetStart = pos + i;
+}
+
+// bytes[0] should have been a sync byte and was not.
+void TsTracker::lostSync(const uint8_t *bytes, size_t len, uint64_t pos)
+{
+    Logger::Log(LogLevel::DEBUG, "TsTracker::lostSync: Lost packet sync at stream offset " + std::to_string(pos));
+    start_.synced = false;
+    // The bytes lost are the largest continuity gap there is
+    start_.randomAccess.reset();
+    carry_.assign(reinterpret_cast<const char *>(bytes), len);
+    carryPos_ = pos;
+    search();
+}
+
+void TsTracker::parsePacket(const uint8_t *packet, TsHeader header, uint64_t pos)
+{
+    uint16_t pid = header.pid();
+    // Null packets share NoPid with the PIDs not yet known
+    if (header.error() || pid == NoPid || (pid != 0 && pid != pmtPid_ && pid != videoPid_))
+    {
+        return;
+    }
+
+    if (pid == videoPid_ && header.hasPayload())
+    {
+        // A gap after the keyframe leaves its GOP undecodable; a repeated
+        // counter is a legal duplicate
+        int cc = header.cc();
+        if (videoCc_ >= 0 && cc != videoCc_ && cc != ((videoCc_ + 1) & 0xF))
+        {
+            start_.randomAccess.reset();
+        }
+        videoCc_ = cc;
+    }
+
+    if (!header.unitStart() || !header.hasPayload())
+    {
+        return;
+    }
+
+    size_t payload = 4;
+    bool randomAccess = false;
+    if (header.hasAdaptation())
+    {
+        size_t fieldLength = packet[4];
+        if (fieldLength > PacketSize - 5)
+        {
+            return;
+        }
+        if (fieldLength > 0)
+        {
+            randomAccess = packet[5] & 0x40; // random_access_indicator
+        }
+        payload = 5 + fieldLength;
+    }
+    if (payload >= PacketSize)
+    {
+        return;
+    }
+
+    if (pid == 0)
+    {
+        parsePat(packet, payload);
+    }
+    else if (pid == pmtPid_)
+    {
+        parsePmt(packet, payload);
+    }
+    else if (pid == videoPid_ && (randomAccess || startsKeyframe(packet + payload, PacketSize - payload)))
+    {
+        start_.randomAccess = pos;
+    }
+}
+
+void TsTracker::parsePat(const uint8_t *packet, size_t payload)
+{
+    size_t section = payload + 1 + packet[payload]; // Skip pointer_field
+    if (section + 8 > PacketSize || packet[section] != 0x00)
+    {
+        return;
+    }
+    size_t end = section + 3 + (((packet[section + 1] & 0x0F) << 8) | packet[section + 2]);
+    if (end > PacketSize || end < section + 12)
+    {
+        return; // Spans packets; keep the one we have
+    }
+
+    // Programs follow the 8-byte header, the CRC closes the section
+    for (size_t i = section + 8; i + 4 <= end - 4; i += 4)
+    {
+        uint16_t program = static_cast<uint16_t>((packet[i] << 8) | packet[i + 1]);
+        uint16_t pid = static_cast<uint16_t>(((packet[i + 2] & 0x1F) << 8) | packet[i + 3]);
+        if (program == 0)
+        {
+            continue; // Network PID
+        }
+        if (pid != pmtPid_)
+        {
+            pmtPid_ = pid;
+            videoPid_ = NoPid;
+            codec_ = Codec::None;
+            pmt_.clear();
+            start_.randomAccess.reset();
+        }
+        break;
+    }
+
+    // Repeats differ in their continuity counter only
+    if (pat_.empty() || std::memcmp(pat_.data() + 4, packet + 4, PacketSize - 4) != 0)
+    {
+        pat_.assign(reinterpret_cast<const char *>(packet), PacketSize);
+        publishHeaders();
+    }
+}
+
+void TsTracker::parsePmt(const uint8_t *packet, size_t payload)
+{
+    size_t section = payload + 1 + packet[payload];
+    if (section + 12 > PacketSize || packet[section] != 0x02)
+    {
+        return;
+    }
+    size_t end = section + 3 + (((packet[section + 1] & 0x0F) << 8) | packet[section + 2]);
+    if (end > PacketSize || end < section + 16)
+    {
+        return;
+    }
+
+    uint16_t videoPid = NoPid;
+    Codec codec = Codec::None;
+    size_t i = section + 12 + (((packet[section + 10] & 0x0F) << 8) | packet[section + 11]);
+    while (i + 5 <= end - 4)
+    {
+        uint8_t streamType = packet[i];
+        uint16_t pid = static_cast<uint16_t>(((packet[i + 1] & 0x1F) << 8) | packet[i + 2]);
+        switch (streamType)
+        {
+        case 0x01:
+        case 0x02:
+            codec = Codec::Mpeg2;
+            break;
+        case 0x1B:
+            codec = Codec::H264;
+            break;
+        case 0x24:
+            codec = Codec::Hevc;
+            break;
+        case 0x10:
+        case 0x42:
+        case 0xEA:
+            codec = Codec::Other;
+            break;
+        }
+        if (codec != Codec::None)
+        {
+            videoPid = pid;
+            break;
+        }
+        i += 5 + (((packet[i + 3] & 0x0F) << 8) | packet[i + 4]);
+    }
+
+    if (videoPid != videoPid_)
+    {
+        videoPid_ = videoPid;
+        codec_ = codec;
+        start_.randomAccess.reset();
+    }
+
+    if (pmt_.empty() || std::memcmp(pmt_.data() + 4, packet + 4, PacketSize - 4) != 0)
+    {
+        pmt_.assign(reinterpret_cast<const char *>(packet), PacketSize);
+        publishHeaders();
+    }
+}
+
+// Whether the PES packet starting in pes opens with a keyframe, judged from
+// the start codes in this first TS packet: an IDR or SPS for H.264, an IRAP,
+// VPS or SPS for HEVC, a sequence header for MPEG-2.
+bool TsTracker::startsKeyframe(const uint8_t *pes, size_t len) const
+{
+    if (codec_ == Codec::None || codec_ == Codec::Other)
+    {
+        return false;
+    }
+    if (len < 9 || pes[0] != 0 || pes[1] != 0 || pes[2] != 1)
+    {
+        return false;
+    }
+
+    for (size_t i = 9 + pes[8]; i + 3 < len; ++i)
+    {
+        if (pes[i] != 0 || pes[i + 1] != 0 || pes[i + 2] != 1)
+        {
+            continue;
+        }
+
+        uint8_t code = pes[i + 3];
+        switch (codec_)
+        {
+        case Codec::H264:
+        {
+            uint8_t type = code & 0x1F;
+            if (type == 5 || type == 7)
+                return true;
+            break;
+        }
+        case Codec::Hevc:
+        {
+            uint8_t type = (code >> 1) & 0x3F;
+            if ((type >= 16 && type <= 21) || type == 32 || type == 33)
+                return true;
+            break;
+        }
+        case Codec::Mpeg2:
+            if (code == 0xB3)
+                return true;
+            break;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+void TsTracker::publishHeaders()
+{
+    if (pat_.empty() || pmt_.empty())
+    {
+        start_.headers.reset();
+        return;
+    }
+    start_.headers = std::make_shared<const std::string>(pat_ + pmt_);
+}
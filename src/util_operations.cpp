@@ -1,41 +1,38 @@
 // File: util_operations.cpp
 #include "util_operations.hpp"
 #include <logger.hpp>
-#include <unordered_map>
-#include <atomic>
+#include <fuse_operations.hpp>
 #include <smfs_state.hpp>
 #include <unistd.h>
 #include <string.h>
 
-// Map for path-to-inode mapping
-std::unordered_map<std::string, fuse_ino_t> pathToInode;
-std::unordered_map<fuse_ino_t, std::string> inodeToPath;
-std::atomic<fuse_ino_t> nextInode{2}; // Start at 2, as 1 is reserved for the root inode
+InodeTable inodeTable;
 
-// Helper: Generate unique inodes
 fuse_ino_t getInode(const std::string &path)
 {
-    Logger::Log(LogLevel::DEBUG, "getInode: Looking up inode for path: " + path);
+    return inodeTable.get(path);
+}
 
-    if (pathToInode.find(path) == pathToInode.end())
-    {
-        Logger::Log(LogLevel::TRACE, "getInode: Inode not found, creating new inode for path: " + path);
-        pathToInode[path] = nextInode++;
-        inodeToPath[pathToInode[path]] = path;
-        Logger::Log(LogLevel::DEBUG, "getInode: Created inode " + std::to_string(pathToInode[path]) + " for path: " + path);
-    }
-    else
+bool isPrivatePath(std::string_view path)
+{
+    if (!path.starts_with('/') || !path.substr(1).starts_with(PrivateDirName))
     {
-        Logger::Log(LogLevel::TRACE, "getInode: Found existing inode " + std::to_string(pathToInode[path]) + " for path: " + path);
+        return false;
     }
-
-    return pathToInode[path];
+    path.remove_prefix(1 + PrivateDirName.size());
+    return path.empty() || path.starts_with('/');
 }
 
 void fs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi)
 {
     (void)fi;
-    std::string path = inodeToPath[ino];
+    auto inodePath = inodeTable.path(ino);
+    if (!inodePath)
+    {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    std::string path = *inodePath;
     Logger::Log(LogLevel::DEBUG, "fs_setattr: Modifying attributes for " + path);
 
     std::string fullPath = g_state->cacheDir + path;
@@ -70,14 +67,27 @@ void fs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, s
         return;
     }
 
-    fuse_reply_attr(req, &st, 1.0);
+    fuse_reply_attr(req, &st, UserFileTimeout);
 }
 
 void fs_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev)
 {
     (void)rdev;
-    std::string parentPath = inodeToPath[parent];
-    std::string path = parentPath + "/" + name;
+    auto parentPath = inodeTable.path(parent);
+    if (!parentPath)
+    {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    // Spelled as fs_lookup does, so the miss and the inode match
+    std::string path = (*parentPath == "/" ? "" : *parentPath) + "/" + name;
+
+    if (isPrivatePath(path))
+    {
+        Logger::Log(LogLevel::WARN, "fs_mknod: Refusing to create " + path + " in SMFS's own directory");
+        fuse_reply_err(req, EACCES);
+        return;
+    }
 
     Logger::Log(LogLevel::DEBUG, "fs_mknod: Creating file " + path);
 
@@ -106,6 +116,7 @@ void fs_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode,
         return;
     }
     close(fd);
+    g_state->negativeCache.erase(path);
 
     struct stat st;
     if (lstat(fullPath.c_str(), &st) == -1)
@@ -117,12 +128,13 @@ void fs_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode,
 
     struct fuse_entry_param e = {};
     e.ino = getInode(path);
+    inodeTable.ref(e.ino);
     e.attr = st;
-    e.attr_timeout = 1.0;
-    e.entry_timeout = 1.0;
+    e.attr_timeout = UserFileTimeout;
+    e.entry_timeout = UserFileTimeout;
 
     Logger::Log(LogLevel::DEBUG, "fs_mknod: File created successfully at " + fullPath);
-    fuse_reply_entry(req, &e);
+    replyEntry(req, e);
 }
 
 void fs_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size)
@@ -187,8 +187,9 @@ void WebSocketClient::HandleMessage(std::string message)
     {
         std::string filePath = message.substr(7);
         Logger::Log(LogLevel::INFO, "Delete command received for file: " + filePath);
-        std::lock_guard<std::mutex> lock(g_state->filesMutex);
-        g_state->files.erase(filePath);
+        g_state->updateCatalog([&](Catalog &catalog)
+                               { catalog.erase(filePath); });
+        g_state->apiClient.notifyChanged({filePath});
     }
     else if (message == "shutdown")
     {